@@ -1,18 +1,91 @@
 #include <stdio.h>
+#include <string.h>
+#include "vehicle_log.h"
 
-int main() {
-    FILE *fp = fopen("vehicle.data", "r");
-    if (!fp) {
-        printf("vehicle.data not found\n");
+void print_entry(const VehicleLogEntry *entry) {
+    printf("Road %d, Lane %d -> Vehicle %d (producer %d, arrived %llu us)\n",
+           entry->road, entry->lane, entry->id, entry->producer, (unsigned long long)entry->arrival_us);
+}
+
+void print_text_entry(const VehicleLogEntry *entry, void *context) {
+    (void)context;
+    print_entry(entry);
+}
+
+int dump_text(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 1;
+
+    printf("Current Vehicles in %s:\n", path);
+    int malformed = 0;
+    if (vehicle_log_read_text_file(fp, print_text_entry, NULL, &malformed) < 0) {
+        printf("Out of memory reading %s\n", path);
+        fclose(fp);
+        return 1;
+    }
+    if (malformed > 0) {
+        printf("%d malformed lines skipped\n", malformed);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int dump_binary(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 1;
+
+    VehicleLogHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || !vehicle_log_check_header(&header, sizeof(header))) {
+        printf("%s is not a version %d vehicle log\n", path, VEHICLE_LOG_VERSION);
+        fclose(fp);
         return 1;
     }
 
-    printf("Current Vehicles in File:\n");
-    int road, lane, id;
-    while (fscanf(fp, "%d %d %d", &road, &lane, &id) == 3) {
-        printf("Road %d, Lane %d -> Vehicle %d\n", road, lane, id);
+    printf("Current Vehicles in %s:\n", path);
+    VehicleLogRecord record;
+    VehicleLogEntry entry;
+    long index = 0;
+    while (fread(&record, sizeof(record), 1, fp) == 1) {
+        if (vehicle_log_decode(&record, &entry)) {
+            print_entry(&entry);
+        } else {
+            printf("Record %ld: bad checksum\n", index);
+        }
+        index++;
     }
 
     fclose(fp);
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char *argv[]) {
+    bool text = argc > 1 && strcmp(argv[1], "--text") == 0;
+
+    // Segments the simulator has already consumed are gone, so only the
+    // unread tail of each producer's log is left to show
+    VehicleLogManifest manifest;
+    vehicle_log_read_manifest(&manifest);
+
+    int segments = 0;
+    for (int producer = 0; producer < MAX_PRODUCERS; producer++) {
+        for (long segment = manifest.consumed[producer] + 1;; segment++) {
+            char path[64];
+            vehicle_log_segment_path(path, sizeof(path), producer, segment, text);
+            if (vehicle_log_file_size(path) < 0) break;
+
+            if (text) {
+                dump_text(path);
+            } else {
+                dump_binary(path);
+            }
+            segments++;
+        }
+    }
+
+    if (segments == 0) {
+        printf("No unread vehicle log segments found\n");
+        return 1;
+    }
+    return 0;
+}
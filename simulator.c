@@ -1,7 +1,18 @@
 #include <SDL3/SDL.h>
+#include <SDL3/SDL_intrin.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <math.h>
+#include "vehicle_log.h"
+#include "vehicle_ring.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 800
@@ -9,212 +20,3140 @@
 #define ROAD_WIDTH 150
 #define LANE_WIDTH 50
 #define VEHICLE_SIZE 40
-#define MAX_VEHICLES 200
+#define MAX_VEHICLES 200 // Default live vehicle limit, see --capacity
+#define POOL_CHUNK 1024   // Vehicle slots allocated at a time
+
+// Intelligent Driver Model parameters, in pixels and seconds
+#define DESIRED_SPEED 100.0f // Cruising speed on an open road
+#define MAX_ACCEL 150.0f
+#define COMFORT_DECEL 250.0f
+#define TIME_HEADWAY 0.5f    // Following distance kept per unit of speed
+#define MIN_GAP 8.0f         // Bumper-to-bumper gap when stopped
+#define FREE_ROAD 1e6f       // Gap used when nothing is ahead
 #define TRAFFIC_LIGHT_SIZE 15
 #define PRIORITY_THRESHOLD 10
+#define READER_CHUNK_SIZE 4096
+#define READER_FINGERPRINT 32
+#define LATENCY_SAMPLES 65536
+#define SPAWN_LIST_CAPACITY 1024
+#define PARSE_BATCH 256
+#define INGEST_POLL_MS 500 // Ingest thread polling interval without --watch
+#define INGEST_WAIT_MS 100 // With --watch, re-check the source at least this often
+#define HITCH_MS 25        // Frames longer than this count as hitches
+#define FRAME_BUCKET_US 100 // Resolution of the frame time percentiles
+#define FRAME_BUCKETS 1000  // Up to 100 ms; longer frames share the last bucket
+#define DEFAULT_REFRESH_HZ 60 // Frame rate cap when the display doesn't report one
+#define PROFILE_SUB_BITS 4  // 16 profiler buckets per power of two
+#define PROFILE_BUCKETS ((32 - PROFILE_SUB_BITS + 1) << PROFILE_SUB_BITS) // Up to 2^32 ns
+#define PROFILE_CSV "profile.csv"
+#define SIM_HZ 120         // Default simulation steps per second, see --hz
+#define MAX_SUBSTEPS 8     // Most steps run in one batch; time beyond that is dropped
+#define SNAPSHOT_FRESH 4   // Set in snapshot_middle while the renderer hasn't taken it
+#define TRACE_SPACING_MS 500 // Gap between arrivals in a trace without timestamps, as the generators pace them
+#define GRID_LINK_CAPACITY 16   // Vehicles in flight on one grid link; must be a power of two
+#define GRID_ARRIVAL_RATE 0.2f  // Vehicles per second entering each lane at the edge of the grid
+#define GRID_DEFAULT_SECONDS 60 // Simulated time per --grid run without --duration
+#define GRID_BARRIER_SPINS 4000 // Busy-waits at the step barrier before yielding the core
+#define MAX_GRID_WORKERS 64
+#define PARAREAL_COARSE_MS 500  // Step of the coarse propagator in --parareal
+#define PARAREAL_TOLERANCE 0.5f // Slice boundaries closer than this (px, px/s) count as converged
+#define PARAREAL_DRAIN_S 120    // Simulated after the last arrival by --parareal without --duration
+#define SEGMENT_ARCHIVE_DIR "archive"
+#define BENCH_TICKS 100    // Simulation steps timed per size by --bench
+#define BENCH_LIVE_IDS 100000   // Vehicles kept in the index by the --bench ingest case
+#define BENCH_RECORDS 1000000   // Records looked up and inserted against them
+#define BENCH_SCAN_RECORDS 1000 // Records timed against a linear scan for comparison
+#define KERNEL_CHECK_LANES 10000 // Random lanes compared by --check-kernels
+#define KERNEL_TOLERANCE 1e-3f   // Allowed drift from the scalar kernel, e.g. if the compiler fuses multiply-adds
+
+// Names one vehicle for as long as it lives: the generation in the top 32
+// bits and the pool slot in the bottom 32. Once the vehicle despawns the
+// slot's generation moves on, so old handles stop resolving instead of
+// pointing at whoever reuses the slot. 0 is never a valid handle.
+typedef uint64_t VehicleHandle;
+
+// Per-vehicle data that the movement loop doesn't touch
+typedef struct {
+    uint32_t generation;
+    int next_free;     // Next free slot in the chunk while this one is free, -1 at the end
+    int id;            // Sequence number within its producer
+    int producer;      // Generator that created it
+    int road;
+    int lane;
+} VehicleSlot;
+
+typedef struct {
+    VehicleSlot slots[POOL_CHUNK];
+    int free_head;     // First free slot, -1 if the chunk is full
+    int live;
+} VehicleChunk;
+
+// Slots are handed out in fixed-size chunks that never move, lowest chunk
+// first, so live vehicles gather at the front and empty chunks at the back
+// can be given back when traffic drops
+typedef struct {
+    VehicleChunk **chunks;
+    int chunk_count;
+    int chunk_capacity;    // Length of the chunks array
+    int first_free_chunk;  // No chunk before this one has a free slot
+    uint32_t max_generation; // Highest generation handed out, so reallocated chunks start above it
+} VehiclePool;
+
+// Vehicles are stored by road and lane as parallel arrays. Everyone in a
+// lane drives along the same line, so a vehicle's position is one distance
+// `s` from where the lane enters the window, and vehicles never overtake:
+// the oldest, furthest along, is always at `head`. The grid and Parareal
+// engines keep lanes of their own with the same layout and helpers.
+typedef struct {
+    float *s;          // Distance travelled from the window edge (negative while queued off-screen)
+    float *v;          // Speed along the lane
+    float *prev_s;     // s before the latest step, to draw in between steps
+    uint8_t *waiting;  // 1 while stopped at a red light (bytes, so the update loop vectorizes)
+    Uint64 *born_ns;   // Simulated time its trip started
+    float *born_s;     // Where its trip started, behind the window edge if the lane was backed up
+    VehicleHandle *handle; // Everything else about the vehicle lives in the pool
+    int head;          // Vehicles [head, count) are on the road
+    int count;
+    int capacity;
+    float origin_x, origin_y; // Where the lane enters the window
+    float dir_x, dir_y;       // Unit direction of travel
+    float stop_s;      // Vehicles before this point wait on red
+    float exit_s;      // Vehicles past this point have reached the center
+} LanePartition;
+
+typedef struct {
+    bool green[4]; // One for each road
+    int vehicle_count[4][3]; // Waiting vehicles per road and lane, kept up to date as they stop and go
+} TrafficLight;
+
+VehiclePool vehicle_pool;
+LanePartition lanes[4][3];
+float *accel_scratch = NULL; // Per-lane accelerations between the two passes of lane_step()
+int accel_scratch_capacity = 0;
+int vehicle_count = 0; // Live vehicles across all lanes
+int vehicle_capacity = MAX_VEHICLES; // 0 means no limit
+bool priority_threshold_crossed = false; // A priority lane reached PRIORITY_THRESHOLD since the lights last changed
+TrafficLight traffic_light;
+bool debug_checks = false; // --debug-checks: recount waiting vehicles and cross-check the lane kernels
+int last_processed_id[MAX_PRODUCERS]; // High-water mark per producer
+
+// The simulation clock. Windowed or headless, the simulation only ever
+// moves forward in fixed steps through simulation_step().
+typedef struct {
+    Uint64 step_ns;
+    float step_seconds;
+    Uint64 time_ns;     // Simulated time so far
+    Uint64 last_light_update_ns;
+    long steps;
+    bool reactive_lights; // Re-plan the lights as soon as a priority lane fills up
+} Simulation;
+
+// Vehicles that made it through the intersection
+typedef struct {
+    long trips;
+    double total_travel_s;
+    double total_delay_s; // Time lost compared with driving through at DESIRED_SPEED
+    double max_delay_s;
+} TripStats;
+
+Simulation simulation;
+TripStats trip_stats;
+
+void init_traffic_light() {
+    for (int i = 0; i < 4; i++) {
+        traffic_light.green[i] = false;
+        for (int j = 0; j < 3; j++) {
+            traffic_light.vehicle_count[i][j] = 0;
+        }
+    }
+}
+
+// Full recount of waiting vehicles, to check the running counts against
+void count_vehicles_per_lane(int counts[4][3]) {
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            const LanePartition *partition = &lanes[road][lane];
+            int waiting = 0;
+            for (int i = partition->head; i < partition->count; i++) {
+                waiting += partition->waiting[i];
+            }
+            counts[road][lane] = waiting;
+        }
+    }
+}
+
+// Gives the green to one road based on its waiting vehicle counts
+void plan_traffic_lights(TrafficLight *light) {
+    // Reset all lights
+    for (int i = 0; i < 4; i++) {
+        light->green[i] = false;
+    }
+
+    // Check lane 2 (index 2) priority for each road
+    int priority_road = -1;
+    int max_lane2_count = 0;
+
+    for (int road = 0; road < 4; road++) {
+        if (light->vehicle_count[road][2] >= PRIORITY_THRESHOLD) {
+            if (light->vehicle_count[road][2] > max_lane2_count) {
+                max_lane2_count = light->vehicle_count[road][2];
+                priority_road = road;
+            }
+        }
+    }
+
+    // If a road has priority lane threshold, give it green
+    if (priority_road >= 0) {
+        light->green[priority_road] = true;
+    } else {
+        // Otherwise, find road with most waiting vehicles
+        int max_total = 0;
+        int busiest_road = -1;
+
+        for (int road = 0; road < 4; road++) {
+            int total = 0;
+            for (int lane = 0; lane < 3; lane++) {
+                total += light->vehicle_count[road][lane];
+            }
+            if (total > max_total) {
+                max_total = total;
+                busiest_road = road;
+            }
+        }
+
+        if (busiest_road >= 0) {
+            light->green[busiest_road] = true;
+        }
+    }
+}
+
+void update_traffic_lights() {
+    if (debug_checks) {
+        // The running counts must match a full recount; a drift is a bug, not something to paper over
+        int counts[4][3];
+        count_vehicles_per_lane(counts);
+        SDL_assert_always(memcmp(counts, traffic_light.vehicle_count, sizeof(counts)) == 0);
+    }
+    priority_threshold_crossed = false;
+    plan_traffic_lights(&traffic_light);
+}
+
+// Returns a free slot and its handle, or NULL if out of memory
+VehicleSlot *pool_alloc(VehiclePool *pool, VehicleHandle *handle) {
+    while (pool->first_free_chunk < pool->chunk_count &&
+           pool->chunks[pool->first_free_chunk]->free_head < 0) {
+        pool->first_free_chunk++;
+    }
+
+    if (pool->first_free_chunk == pool->chunk_count) {
+        if (pool->chunk_count == pool->chunk_capacity) {
+            int capacity = pool->chunk_capacity ? pool->chunk_capacity * 2 : 4;
+            VehicleChunk **chunks = realloc(pool->chunks, capacity * sizeof(VehicleChunk *));
+            if (!chunks) return NULL;
+            pool->chunks = chunks;
+            pool->chunk_capacity = capacity;
+        }
+
+        VehicleChunk *chunk = malloc(sizeof(VehicleChunk));
+        if (!chunk) return NULL;
+        for (int i = 0; i < POOL_CHUNK; i++) {
+            // Start above every generation handed out before, in case this
+            // chunk's slots were in use once already
+            chunk->slots[i].generation = pool->max_generation + 1;
+            chunk->slots[i].next_free = i + 1 < POOL_CHUNK ? i + 1 : -1;
+        }
+        chunk->free_head = 0;
+        chunk->live = 0;
+        pool->chunks[pool->chunk_count++] = chunk;
+    }
+
+    int chunk_index = pool->first_free_chunk;
+    VehicleChunk *chunk = pool->chunks[chunk_index];
+    int i = chunk->free_head;
+    VehicleSlot *slot = &chunk->slots[i];
+    chunk->free_head = slot->next_free;
+    chunk->live++;
+
+    if (slot->generation > pool->max_generation) pool->max_generation = slot->generation;
+    *handle = ((VehicleHandle)slot->generation << 32) | (uint32_t)(chunk_index * POOL_CHUNK + i);
+    return slot;
+}
+
+// Returns the slot a handle names, or NULL once that vehicle is gone
+VehicleSlot *pool_get(const VehiclePool *pool, VehicleHandle handle) {
+    uint32_t index = (uint32_t)handle;
+    int chunk_index = index / POOL_CHUNK;
+    if (chunk_index >= pool->chunk_count) return NULL;
+
+    VehicleSlot *slot = &pool->chunks[chunk_index]->slots[index % POOL_CHUNK];
+    return slot->generation == (uint32_t)(handle >> 32) ? slot : NULL;
+}
+
+void pool_free(VehiclePool *pool, VehicleHandle handle) {
+    VehicleSlot *slot = pool_get(pool, handle);
+    if (!slot) return;
+
+    uint32_t index = (uint32_t)handle;
+    int chunk_index = index / POOL_CHUNK;
+    VehicleChunk *chunk = pool->chunks[chunk_index];
+    slot->generation++;
+    slot->next_free = chunk->free_head;
+    chunk->free_head = index % POOL_CHUNK;
+    chunk->live--;
+    if (chunk_index < pool->first_free_chunk) pool->first_free_chunk = chunk_index;
+
+    // Give back empty chunks at the end, keeping one spare so traffic
+    // hovering around a chunk boundary doesn't allocate and free repeatedly
+    while (pool->chunk_count >= 2 && pool->chunks[pool->chunk_count - 1]->live == 0 &&
+           pool->chunks[pool->chunk_count - 2]->live == 0) {
+        VehicleChunk *last = pool->chunks[--pool->chunk_count];
+        for (int i = 0; i < POOL_CHUNK; i++) {
+            if (last->slots[i].generation > pool->max_generation) pool->max_generation = last->slots[i].generation;
+        }
+        free(last);
+    }
+    if (pool->first_free_chunk > pool->chunk_count) pool->first_free_chunk = pool->chunk_count;
+}
+
+void pool_destroy(VehiclePool *pool) {
+    for (int i = 0; i < pool->chunk_count; i++) {
+        free(pool->chunks[i]);
+    }
+    free(pool->chunks);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Open-addressing (linear probing) index from (producer, id) to the
+// vehicle's handle, so duplicate checks don't scan every live vehicle
+typedef struct {
+    uint64_t *keys;
+    VehicleHandle *handles; // 0 marks an empty bucket
+    int capacity; // Always a power of two
+    int count;
+} VehicleIndex;
+
+VehicleIndex vehicle_index;
+
+uint64_t vehicle_key(int producer, int id) {
+    return ((uint64_t)(uint32_t)producer << 32) | (uint32_t)id;
+}
+
+int index_bucket(const VehicleIndex *index, uint64_t key) {
+    // splitmix64 finalizer spreads sequential IDs across the table
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return (int)(key & (uint64_t)(index->capacity - 1));
+}
+
+// Returns false if out of memory, leaving the index empty
+bool index_init(VehicleIndex *index, int capacity) {
+    int rounded = 16;
+    while (rounded < capacity) rounded *= 2;
+    capacity = rounded;
+
+    index->keys = malloc(capacity * sizeof(uint64_t));
+    index->handles = calloc(capacity, sizeof(VehicleHandle));
+    index->count = 0;
+    if (!index->keys || !index->handles) {
+        free(index->keys);
+        free(index->handles);
+        index->keys = NULL;
+        index->handles = NULL;
+        index->capacity = 0;
+        return false;
+    }
+    index->capacity = capacity;
+    return true;
+}
+
+void index_free(VehicleIndex *index) {
+    free(index->keys);
+    free(index->handles);
+    index->keys = NULL;
+    index->handles = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
+
+// Returns the bucket holding key, or -1 if it isn't indexed
+int index_find(const VehicleIndex *index, uint64_t key) {
+    int mask = index->capacity - 1;
+    for (int b = index_bucket(index, key); index->handles[b] != 0; b = (b + 1) & mask) {
+        if (index->keys[b] == key) return b;
+    }
+    return -1;
+}
+
+bool index_put(VehicleIndex *index, uint64_t key, VehicleHandle handle);
+
+// Returns false if out of memory, leaving the index as it was
+bool index_grow(VehicleIndex *index) {
+    VehicleIndex old = *index;
+    if (!index_init(index, old.capacity * 2)) {
+        *index = old;
+        return false;
+    }
+    for (int b = 0; b < old.capacity; b++) {
+        if (old.handles[b] != 0) index_put(index, old.keys[b], old.handles[b]);
+    }
+    index_free(&old);
+    return true;
+}
+
+// Inserts key or, if it is already indexed, points it at a new handle.
+// Returns false if out of memory.
+bool index_put(VehicleIndex *index, uint64_t key, VehicleHandle handle) {
+    // Keep the load factor at or below one half so probe runs stay short
+    if ((index->count + 1) * 2 > index->capacity && !index_grow(index)) return false;
+
+    int mask = index->capacity - 1;
+    int b = index_bucket(index, key);
+    while (index->handles[b] != 0 && index->keys[b] != key) {
+        b = (b + 1) & mask;
+    }
+    if (index->handles[b] == 0) index->count++;
+    index->keys[b] = key;
+    index->handles[b] = handle;
+    return true;
+}
+
+void index_remove(VehicleIndex *index, uint64_t key) {
+    int b = index_find(index, key);
+    if (b < 0) return;
+
+    // Backward-shift deletion: pull later entries of the probe run into the
+    // hole so lookups never need tombstones
+    int mask = index->capacity - 1;
+    int hole = b;
+    for (int next = (hole + 1) & mask; index->handles[next] != 0; next = (next + 1) & mask) {
+        int home = index_bucket(index, index->keys[next]);
+        // Move the entry unless its home lies cyclically in (hole, next]
+        bool stays = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!stays) {
+            index->keys[hole] = index->keys[next];
+            index->handles[hole] = index->handles[next];
+            hole = next;
+        }
+    }
+    index->handles[hole] = 0;
+    index->count--;
+}
+
+typedef struct {
+    int producer;                        // Whose log this reader follows
+    long segment;                        // Segment being read; earlier ones are consumed
+    long offset;                         // Byte offset just past the last complete record
+    char fingerprint[READER_FINGERPRINT]; // First bytes of the file, to detect rotation
+    size_t fingerprint_len;
+    VehicleLogMap map;                   // Current mapping of the binary log
+    int corrupt_records;                 // Binary records skipped for a bad checksum
+    int malformed_lines;                 // Text lines that weren't records
+    bool discarding;                     // Inside a line too long to be a record, skipping to its end
+} VehicleReader;
+
+VehicleReader segment_readers[MAX_PRODUCERS];
+VehicleLogManifest manifest;      // Segments already consumed, owned by the ingest side
+bool archive_segments = false;    // Set when running with --archive
+VehicleRing *vehicle_ring = NULL; // Set when running with --shm
+bool use_text_log = false;        // Set when running with --text
+
+// Generate-to-spawn latency of every record with a send time, kept as a rolling window
+uint64_t latency_samples[LATENCY_SAMPLES];
+int latency_sample_count = 0;
+
+// Admission queue: records accepted by the reader but not spawned yet.
+// Each record is parsed once and waits here, bounded at two lists' worth,
+// until a vehicle slot frees up; when it's full the readers simply stop, so
+// nothing is re-read or re-checked in the meantime. It is double-buffered:
+// the ingest thread appends to `incoming` under spawn_lock while the
+// simulation loop works through `spawning` without any lock, and the two are
+// swapped in O(1) once `spawning` has been used up.
+typedef struct {
+    VehicleRecord records[SPAWN_LIST_CAPACITY];
+    int count;
+} SpawnList;
+
+SpawnList spawn_lists[2];
+SpawnList *incoming = &spawn_lists[0];
+SpawnList *spawning = &spawn_lists[1];
+int spawning_next = 0; // First record in `spawning` that hasn't spawned yet
+SDL_Mutex *spawn_lock = NULL;
+
+SDL_AtomicInt backlog_depth; // Records in both lists, for the on-screen gauge
+int backlog_peak = 0;
+long backlog_stalled_frames = 0; // Frames where the backlog waited for a free slot
+
+SDL_Thread *ingest_thread = NULL;
+SDL_AtomicInt ingest_running;
+SDL_Semaphore *ingest_wakeup = NULL; // Signalled to stop a polling ingest thread early
+
+void init_lanes() {
+    float center_x = WINDOW_WIDTH / 2;
+    float center_y = WINDOW_HEIGHT / 2;
+    float stop_distance = 180.0f; // Distance from center to stop
+
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            LanePartition *partition = &lanes[road][lane];
+            memset(partition, 0, sizeof(*partition));
+
+            switch (road) {
+                case 0: // North (top), moving down
+                    partition->origin_x = center_x - ROAD_WIDTH/2 + LANE_WIDTH/2 + lane * LANE_WIDTH;
+                    partition->origin_y = 0;
+                    partition->dir_y = 1;
+                    break;
+                case 1: // East (right), moving left
+                    partition->origin_x = WINDOW_WIDTH;
+                    partition->origin_y = center_y - ROAD_WIDTH/2 + LANE_WIDTH/2 + lane * LANE_WIDTH;
+                    partition->dir_x = -1;
+                    break;
+                case 2: // South (bottom), moving up
+                    partition->origin_x = center_x + ROAD_WIDTH/2 - LANE_WIDTH/2 - lane * LANE_WIDTH;
+                    partition->origin_y = WINDOW_HEIGHT;
+                    partition->dir_y = -1;
+                    break;
+                case 3: // West (left), moving right
+                    partition->origin_x = 0;
+                    partition->origin_y = center_y + ROAD_WIDTH/2 - LANE_WIDTH/2 - lane * LANE_WIDTH;
+                    partition->dir_x = 1;
+                    break;
+            }
+
+            // Vehicles stop while they are more than stop_distance from the
+            // center point, which the lane's sideways offset brings forward
+            float half_length = (road % 2 == 0 ? WINDOW_HEIGHT : WINDOW_WIDTH) / 2;
+            float offset = partition->dir_x != 0 ? partition->origin_y - center_y : partition->origin_x - center_x;
+            partition->stop_s = half_length - sqrtf(stop_distance * stop_distance - offset * offset);
+            partition->exit_s = half_length - CENTER_SIZE/2;
+        }
+    }
+}
+
+// An empty lane laid out like lanes[road][lane], for an engine that keeps its own
+void lane_init_like(LanePartition *partition, int road, int lane) {
+    const LanePartition *geometry = &lanes[road][lane];
+    memset(partition, 0, sizeof(*partition));
+    partition->origin_x = geometry->origin_x;
+    partition->origin_y = geometry->origin_y;
+    partition->dir_x = geometry->dir_x;
+    partition->dir_y = geometry->dir_y;
+    partition->stop_s = geometry->stop_s;
+    partition->exit_s = geometry->exit_s;
+}
+
+void lane_free(LanePartition *partition) {
+    free(partition->s);
+    free(partition->v);
+    free(partition->prev_s);
+    free(partition->waiting);
+    free(partition->born_ns);
+    free(partition->born_s);
+    free(partition->handle);
+    partition->s = NULL;
+    partition->v = NULL;
+    partition->prev_s = NULL;
+    partition->waiting = NULL;
+    partition->born_ns = NULL;
+    partition->born_s = NULL;
+    partition->handle = NULL;
+    partition->head = partition->count = partition->capacity = 0;
+}
+
+void free_lanes() {
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            lane_free(&lanes[road][lane]);
+        }
+    }
+    free(accel_scratch);
+    accel_scratch = NULL;
+    accel_scratch_capacity = 0;
+}
+
+// Slides the live vehicles down to the start of the arrays
+void lane_compact(LanePartition *partition) {
+    int live = partition->count - partition->head;
+    memmove(partition->s, partition->s + partition->head, live * sizeof(float));
+    memmove(partition->v, partition->v + partition->head, live * sizeof(float));
+    memmove(partition->prev_s, partition->prev_s + partition->head, live * sizeof(float));
+    memmove(partition->waiting, partition->waiting + partition->head, live * sizeof(uint8_t));
+    memmove(partition->born_ns, partition->born_ns + partition->head, live * sizeof(Uint64));
+    memmove(partition->born_s, partition->born_s + partition->head, live * sizeof(float));
+    memmove(partition->handle, partition->handle + partition->head, live * sizeof(VehicleHandle));
+    partition->head = 0;
+    partition->count = live;
+}
+
+// Reallocates the arrays; the live vehicles must already fit at the start.
+// Returns false if out of memory, leaving the old capacity in place.
+bool lane_resize(LanePartition *partition, int capacity) {
+    float *s = realloc(partition->s, capacity * sizeof(float));
+    if (s) partition->s = s;
+    float *v = realloc(partition->v, capacity * sizeof(float));
+    if (v) partition->v = v;
+    float *prev_s = realloc(partition->prev_s, capacity * sizeof(float));
+    if (prev_s) partition->prev_s = prev_s;
+    uint8_t *waiting = realloc(partition->waiting, capacity * sizeof(uint8_t));
+    if (waiting) partition->waiting = waiting;
+    Uint64 *born_ns = realloc(partition->born_ns, capacity * sizeof(Uint64));
+    if (born_ns) partition->born_ns = born_ns;
+    float *born_s = realloc(partition->born_s, capacity * sizeof(float));
+    if (born_s) partition->born_s = born_s;
+    VehicleHandle *handle = realloc(partition->handle, capacity * sizeof(VehicleHandle));
+    if (handle) partition->handle = handle;
+    if (!s || !v || !prev_s || !waiting || !born_ns || !born_s || !handle) return false;
+
+    partition->capacity = capacity;
+    return true;
+}
+
+// Appends a vehicle at the lane's entry at speed v, or queued up behind the
+// last one, and no faster, if the lane is backed up to the window edge.
+// Returns false if out of memory.
+bool lane_push(LanePartition *partition, VehicleHandle handle, float v, Uint64 born_ns) {
+    if (partition->count == partition->capacity) {
+        int live = partition->count - partition->head;
+        if (partition->head > 0 && partition->head >= live) {
+            // Mostly departed vehicles at the front: reuse their space
+            lane_compact(partition);
+        } else if (!lane_resize(partition, partition->capacity ? partition->capacity * 2 : 16)) {
+            return false;
+        }
+    }
+
+    int i = partition->count++;
+    partition->s[i] = 0;
+    if (i > partition->head) {
+        float behind = partition->s[i - 1] - VEHICLE_SIZE - MIN_GAP;
+        if (behind < 0) {
+            partition->s[i] = behind;
+            v = SDL_min(v, partition->v[i - 1]);
+        }
+    }
+    partition->v[i] = v;
+    partition->prev_s[i] = partition->s[i];
+    partition->waiting[i] = 0;
+    partition->born_ns[i] = born_ns;
+    partition->born_s[i] = partition->s[i];
+    partition->handle[i] = handle;
+    return true;
+}
+
+// Gives memory back once the lane is down to a quarter of its capacity
+void lane_trim(LanePartition *partition) {
+    int live = partition->count - partition->head;
+    if (partition->capacity <= 16 || live * 4 > partition->capacity) return;
+
+    lane_compact(partition);
+    lane_resize(partition, partition->capacity / 2);
+}
+
+// Returns false if there is no room yet, so the record must be retried later.
+bool spawn_vehicle(int road, int lane, int id, int producer) {
+    // Check if vehicle already exists
+    uint64_t key = vehicle_key(producer, id);
+    if (index_find(&vehicle_index, key) >= 0) return true;
+
+    if (vehicle_capacity > 0 && vehicle_count >= vehicle_capacity) return false;
+
+    VehicleHandle handle;
+    VehicleSlot *slot = pool_alloc(&vehicle_pool, &handle);
+    if (!slot) return false;
+    slot->id = id;
+    slot->producer = producer;
+    slot->road = road;
+    slot->lane = lane;
+
+    LanePartition *partition = &lanes[road][lane];
+    if (!lane_push(partition, handle, DESIRED_SPEED, simulation.time_ns)) {
+        pool_free(&vehicle_pool, handle);
+        return false;
+    }
+    if (!index_put(&vehicle_index, key, handle)) {
+        partition->count--; // Take it back off the end of the lane
+        pool_free(&vehicle_pool, handle);
+        return false;
+    }
+    vehicle_count++;
+    return true;
+}
+
+// Returns false if the file was truncated or replaced since the last read,
+// in which case the reader starts over from the beginning.
+bool check_reader_head(VehicleReader *reader, const void *head, size_t head_len, long size) {
+    if (head_len > READER_FINGERPRINT) head_len = READER_FINGERPRINT;
+
+    bool same_file = size >= reader->offset &&
+                     head_len >= reader->fingerprint_len &&
+                     memcmp(head, reader->fingerprint, reader->fingerprint_len) == 0;
+
+    if (!same_file || reader->fingerprint_len < head_len) {
+        memcpy(reader->fingerprint, head, head_len);
+        reader->fingerprint_len = head_len;
+    }
+    return same_file;
+}
+
+// Each producer numbers its own vehicles, so "new" is judged per producer
+bool is_new_record(int producer, int id) {
+    return producer >= 0 && producer < MAX_PRODUCERS && id > last_processed_id[producer];
+}
+
+// Hands a record to the simulation loop. Returns false if the queue is full,
+// in which case the caller leaves the record unread and retries later.
+bool queue_spawn(int road, int lane, int id, int producer, uint64_t sent_ns) {
+    SDL_LockMutex(spawn_lock);
+    bool queued = incoming->count < SPAWN_LIST_CAPACITY;
+    if (queued) {
+        VehicleRecord record = {road, lane, id, producer, sent_ns};
+        incoming->records[incoming->count++] = record;
+        SDL_AddAtomicInt(&backlog_depth, 1);
+    }
+    SDL_UnlockMutex(spawn_lock);
+
+    if (queued) last_processed_id[producer] = id;
+    return queued;
+}
+
+// How many more records queue_spawn() will accept right now. Only the
+// ingest side adds records, so the room can only grow until it does.
+int spawn_room() {
+    SDL_LockMutex(spawn_lock);
+    int room = SPAWN_LIST_CAPACITY - incoming->count;
+    SDL_UnlockMutex(spawn_lock);
+    return room;
+}
+
+void load_vehicles_from_ring() {
+    const VehicleRecord *record;
+    while ((record = vehicle_ring_peek(vehicle_ring)) != NULL) {
+        if (is_new_record(record->producer, record->id)) {
+            // No room: leave the record in the ring until the queue drains
+            if (!queue_spawn(record->road, record->lane, record->id, record->producer, record->sent_ns)) break;
+        }
+        vehicle_ring_advance(vehicle_ring);
+    }
+}
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void print_latency_report() {
+    int n = latency_sample_count < LATENCY_SAMPLES ? latency_sample_count : LATENCY_SAMPLES;
+    if (n == 0) return;
+
+    qsort(latency_samples, n, sizeof(latency_samples[0]), compare_u64);
+    printf("Generate-to-spawn latency (%s) over %d vehicles: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           vehicle_ring ? "shared memory" : use_text_log ? "text log" : "binary log",
+           n, latency_samples[n / 2] / 1e6, latency_samples[(n * 99) / 100] / 1e6, latency_samples[n - 1] / 1e6);
+}
+
+// Log records carry the wall-clock time the generator wrote them. Moves it
+// onto the vehicle_clock_ns() timebase of shared memory records, so latency
+// is measured the same way for both transports. 0 if the record has none.
+uint64_t log_sent_ns(uint64_t arrival_us) {
+    if (arrival_us == 0) return 0;
+    uint64_t now_us = vehicle_log_now_us();
+    uint64_t age_ns = now_us > arrival_us ? (now_us - arrival_us) * 1000 : 0;
+    return vehicle_clock_ns() - age_ns;
+}
+
+void reset_reader(VehicleReader *reader) {
+    // Truncated or replaced: the old IDs no longer mean anything
+    reader->offset = 0;
+    reader->discarding = false;
+    last_processed_id[reader->producer] = 0;
+}
+
+// Reads a binary segment in place through a mapping that is only refreshed
+// when the file size changes. Returns false if it stopped early because the
+// spawn queue is full.
+bool load_vehicles_from_binary(VehicleReader *reader, const char *path) {
+    long long size = vehicle_log_file_size(path);
+    if (size <= 0) return true;
+
+    VehicleLogMap *map = &reader->map;
+    if ((size_t)size != map->size) {
+        vehicle_log_unmap(map);
+        if (!vehicle_log_map(map, path)) return true;
+    }
+    if (!vehicle_log_check_header(map->data, map->size)) return true;
+
+    if (!check_reader_head(reader, map->data, map->size, (long)map->size)) {
+        reset_reader(reader);
+    }
+    if (reader->offset < (long)sizeof(VehicleLogHeader)) {
+        reader->offset = sizeof(VehicleLogHeader);
+    }
+
+    // A partial trailing record stays unread until the generator finishes it
+    while (reader->offset + sizeof(VehicleLogRecord) <= map->size) {
+        const VehicleLogRecord *record = (const VehicleLogRecord *)(map->data + reader->offset);
+        VehicleLogEntry entry;
+
+        if (!vehicle_log_decode(record, &entry)) {
+            reader->corrupt_records++;
+        } else if (is_new_record(entry.producer, entry.id)) {
+            // No room: leave this record unread until the queue drains
+            if (!queue_spawn(entry.road, entry.lane, entry.id, entry.producer, log_sent_ns(entry.arrival_us))) {
+                return false;
+            }
+        }
+        reader->offset += sizeof(VehicleLogRecord);
+    }
+    return true;
+}
+
+// Text counterpart of load_vehicles_from_binary()
+bool load_vehicles_from_text(VehicleReader *reader, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return true;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    char head[READER_FINGERPRINT];
+    size_t head_len = fread(head, 1, sizeof(head), fp);
+    if (!check_reader_head(reader, head, head_len, size)) {
+        reset_reader(reader);
+    }
+
+    // Read only the bytes appended since the last complete record
+    char buffer[READER_CHUNK_SIZE];
+    size_t used = 0;
+    bool full = false;
+    fseek(fp, reader->offset, SEEK_SET);
+
+    while (reader->offset + (long)used < size) {
+        size_t n = fread(buffer + used, 1, READER_CHUNK_SIZE - used, fp);
+        if (n == 0) break;
+        used += n;
+
+        if (reader->discarding) {
+            // The rest of an over-long line: drop it up to and including its newline
+            char *newline = memchr(buffer, '\n', used);
+            size_t skipped = newline ? (size_t)(newline - buffer) + 1 : used;
+            reader->offset += (long)skipped;
+            used -= skipped;
+            memmove(buffer, buffer + skipped, used);
+            if (!newline) continue;
+            reader->discarding = false;
+        }
+
+        size_t consumed = 0;
+        for (;;) {
+            // Only parse as many records as can be queued, so none are lost
+            int room = spawn_room();
+            if (room == 0) {
+                // No room: leave the rest unread until the queue drains
+                full = true;
+                break;
+            }
+
+            VehicleLogEntry batch[PARSE_BATCH];
+            int count;
+            size_t parsed = vehicle_log_parse_text_batch(buffer + consumed, used - consumed, batch,
+                                                         room < PARSE_BATCH ? room : PARSE_BATCH, &count,
+                                                         &reader->malformed_lines);
+            if (parsed == 0) break;
+
+            for (int k = 0; k < count; k++) {
+                // Only process new vehicles
+                if (is_new_record(batch[k].producer, batch[k].id)) {
+                    queue_spawn(batch[k].road, batch[k].lane, batch[k].id, batch[k].producer,
+                                log_sent_ns(batch[k].arrival_us));
+                }
+            }
+            consumed += parsed;
+        }
+
+        // Keep the partial trailing line for the next chunk or the next poll
+        reader->offset += (long)consumed;
+        used -= consumed;
+        memmove(buffer, buffer + consumed, used);
+
+        if (full) break;
+        if (used == READER_CHUNK_SIZE) {
+            // A single line longer than the buffer can't be a record; skip
+            // all of it, not just what fits, so its tail isn't parsed as one
+            reader->offset += (long)used;
+            used = 0;
+            reader->discarding = true;
+            reader->malformed_lines++;
+        }
+    }
+    fclose(fp);
+    return !full;
+}
+
+// Deletes every consumed segment of the producer that is still on disk, or
+// moves it into the archive directory with --archive
+void compact_segments(int producer) {
+    for (long segment = manifest.consumed[producer]; segment > 0; segment--) {
+        char path[64];
+        vehicle_log_segment_path(path, sizeof(path), producer, segment, use_text_log);
+        if (vehicle_log_file_size(path) < 0) break; // Older ones are already gone
+
+        if (archive_segments) {
+            char archived[96];
+            snprintf(archived, sizeof(archived), SEGMENT_ARCHIVE_DIR "/%s", path);
+            if (!SDL_RenamePath(path, archived)) printf("Cannot archive %s: %s\n", path, SDL_GetError());
+        } else if (!SDL_RemovePath(path)) {
+            printf("Cannot delete %s: %s\n", path, SDL_GetError());
+        }
+    }
+}
+
+// Records the reader's segment as consumed and moves on to the next one
+void finish_segment(VehicleReader *reader) {
+    int producer = reader->producer;
+    vehicle_log_unmap(&reader->map); // Windows can't delete a mapped file
+
+    manifest.consumed[producer] = reader->segment;
+    if (last_processed_id[producer] > manifest.last_id[producer]) {
+        manifest.last_id[producer] = last_processed_id[producer];
+    }
+    if (!vehicle_log_write_manifest(&manifest)) {
+        printf("Cannot write " VEHICLE_LOG_MANIFEST_PATH "\n");
+    }
+    compact_segments(producer);
+
+    reader->segment++;
+    reader->offset = 0;
+    reader->discarding = false;
+    reader->fingerprint_len = 0;
+}
+
+// Picks up where the manifest says the last run stopped
+void init_segment_readers() {
+    vehicle_log_read_manifest(&manifest);
+    if (archive_segments) SDL_CreateDirectory(SEGMENT_ARCHIVE_DIR);
+
+    for (int producer = 0; producer < MAX_PRODUCERS; producer++) {
+        VehicleReader *reader = &segment_readers[producer];
+        reader->producer = producer;
+        reader->segment = manifest.consumed[producer] + 1;
+        last_processed_id[producer] = manifest.last_id[producer];
+        compact_segments(producer);
+    }
+}
+
+// Reads each producer's segments in order. A segment is sealed once its
+// generator has started the next one, and a sealed segment that has been
+// read to the end is consumed.
+void load_vehicles_from_segments() {
+    for (int producer = 0; producer < MAX_PRODUCERS; producer++) {
+        VehicleReader *reader = &segment_readers[producer];
+        for (;;) {
+            char path[64], next_path[64];
+            vehicle_log_segment_path(path, sizeof(path), producer, reader->segment, use_text_log);
+            vehicle_log_segment_path(next_path, sizeof(next_path), producer, reader->segment + 1, use_text_log);
+
+            // Look for the next segment first: if it exists, this one won't grow any more
+            bool sealed = vehicle_log_file_size(next_path) >= 0;
+            bool caught_up = use_text_log ? load_vehicles_from_text(reader, path)
+                                          : load_vehicles_from_binary(reader, path);
+            if (!sealed || !caught_up) break;
+            finish_segment(reader);
+        }
+    }
+}
+
+void read_vehicle_source() {
+    if (vehicle_ring) {
+        load_vehicles_from_ring();
+    } else {
+        load_vehicles_from_segments();
+    }
+}
+
+// Spawns queued records into the free slots. Runs on the simulation loop.
+void spawn_pending_vehicles() {
+    if (spawning_next == spawning->count) {
+        // Everything handed over so far has spawned; take the newer batch
+        spawning->count = 0;
+        spawning_next = 0;
+
+        SDL_LockMutex(spawn_lock);
+        SpawnList *drained = spawning;
+        spawning = incoming;
+        incoming = drained;
+        SDL_UnlockMutex(spawn_lock);
+    }
+
+    int depth = SDL_GetAtomicInt(&backlog_depth);
+    if (depth > backlog_peak) backlog_peak = depth;
+
+    for (; spawning_next < spawning->count; spawning_next++) {
+        const VehicleRecord *record = &spawning->records[spawning_next];
+        if (!spawn_vehicle(record->road, record->lane, record->id, record->producer)) {
+            // No free slot: keep the rest queued until vehicles leave
+            backlog_stalled_frames++;
+            break;
+        }
+        SDL_AddAtomicInt(&backlog_depth, -1);
+
+        if (record->sent_ns != 0) {
+            latency_samples[latency_sample_count % LATENCY_SAMPLES] = vehicle_clock_ns() - record->sent_ns;
+            latency_sample_count++;
+        }
+    }
+}
+
+void print_backlog_report() {
+    printf("Admission backlog: peak %d of %d records, %ld frames waiting for a free vehicle slot\n",
+           backlog_peak, 2 * SPAWN_LIST_CAPACITY, backlog_stalled_frames);
+}
+
+// Change notification on the working directory, where the logs live
+typedef struct {
+    bool active; // False when polling on a timer instead
+#ifdef _WIN32
+    HANDLE change;
+#elif defined(__linux__)
+    int inotify_fd;
+#else
+    int unused;
+#endif
+} SourceWatch;
+
+bool open_source_watch(SourceWatch *watch) {
+    watch->active = true;
+    if (vehicle_ring) return true;
+#ifdef _WIN32
+    watch->change = FindFirstChangeNotificationA(".", FALSE, FILE_NOTIFY_CHANGE_FILE_NAME |
+                                                 FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    watch->active = watch->change != INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+    watch->inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (watch->inotify_fd >= 0 &&
+        inotify_add_watch(watch->inotify_fd, ".", IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+                          IN_MOVED_TO | IN_DELETE) < 0) {
+        close(watch->inotify_fd);
+        watch->inotify_fd = -1;
+    }
+    watch->active = watch->inotify_fd >= 0;
+#else
+    watch->active = false;
+#endif
+    return watch->active;
+}
+
+void close_source_watch(SourceWatch *watch) {
+    if (!watch->active || vehicle_ring) return;
+#ifdef _WIN32
+    FindCloseChangeNotification(watch->change);
+#elif defined(__linux__)
+    close(watch->inotify_fd);
+#endif
+}
+
+// Blocks until the vehicle source may have new data, or timeout_ms passes.
+// With --shm this sleeps on the ring's wakeup instead of the directory. On
+// Linux only changes to log segments count, not the manifest or the
+// profile written from this process.
+void wait_for_source(SourceWatch *watch, int timeout_ms) {
+    if (vehicle_ring) {
+        vehicle_ring_wait(vehicle_ring, timeout_ms);
+        return;
+    }
+#ifdef _WIN32
+    if (WaitForSingleObject(watch->change, (DWORD)timeout_ms) == WAIT_OBJECT_0) {
+        FindNextChangeNotification(watch->change);
+    }
+#elif defined(__linux__)
+    Uint64 deadline = SDL_GetTicks() + timeout_ms;
+    for (Uint64 now = SDL_GetTicks(); now < deadline; now = SDL_GetTicks()) {
+        struct pollfd pfd = {watch->inotify_fd, POLLIN, 0};
+        if (poll(&pfd, 1, (int)(deadline - now)) <= 0) return;
+
+        // Drain everything queued; the descriptor is non-blocking, so this
+        // ends with EAGAIN once it is empty
+        char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        bool segment_changed = false;
+        ssize_t length;
+        while ((length = read(watch->inotify_fd, events, sizeof(events))) > 0) {
+            for (char *at = events; at < events + length;) {
+                const struct inotify_event *event = (const struct inotify_event *)at;
+                if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && vehicle_log_is_segment_name(event->name))) {
+                    segment_changed = true;
+                }
+                at += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (segment_changed || errno != EAGAIN) return;
+    }
+#endif
+}
+
+// Per-phase timings of the window loop, for the overlay toggled with P and
+// the histograms written to PROFILE_CSV on exit. Each phase keeps a
+// log-linear (HDR) histogram of its durations in nanoseconds: exact below
+// 16 ns, then 16 buckets per power of two, so every sample is binned to
+// within about 6%. Phases run on the ingest, simulation and render threads,
+// so the buckets are atomics any thread can bump while the overlay reads them.
+enum {
+    PHASE_INGEST, PHASE_SPAWN, PHASE_LIGHTS, PHASE_VEHICLES, PHASE_SNAPSHOT,
+    PHASE_DRAW_BACKGROUND, PHASE_DRAW_LIGHTS, PHASE_DRAW_VEHICLES, PHASE_DRAW_INFO, PHASE_PRESENT,
+    PHASE_COUNT
+};
+
+const char *phase_names[PHASE_COUNT] = {
+    "load_vehicles", "spawn_vehicles", "update_lights", "update_vehicles", "publish_snapshot",
+    "draw_background", "draw_lights", "draw_vehicles", "draw_info", "present",
+};
+
+SDL_AtomicInt profile_histograms[PHASE_COUNT][PROFILE_BUCKETS];
+SDL_AtomicInt profiling;         // 1 in the window loop, on every thread; headless runs aren't timed
+double profile_ns_per_tick = 0;
+
+// Call before starting any thread that times a phase
+void profiler_init() {
+    profile_ns_per_tick = 1e9 / SDL_GetPerformanceFrequency();
+    SDL_SetAtomicInt(&profiling, 1);
+}
+
+Uint64 profile_begin() {
+    return SDL_GetAtomicInt(&profiling) ? SDL_GetPerformanceCounter() : 0;
+}
+
+int profile_bucket(Uint32 ns) {
+    if (ns < (1u << PROFILE_SUB_BITS)) return (int)ns;
+    int exponent = SDL_MostSignificantBitIndex32(ns);
+    return ((exponent - PROFILE_SUB_BITS + 1) << PROFILE_SUB_BITS) +
+           (int)((ns >> (exponent - PROFILE_SUB_BITS)) & ((1u << PROFILE_SUB_BITS) - 1));
+}
+
+// Shortest duration that lands in a bucket
+Uint64 profile_bucket_low(int bucket) {
+    if (bucket < (1 << PROFILE_SUB_BITS)) return bucket;
+    int exponent = (bucket >> PROFILE_SUB_BITS) + PROFILE_SUB_BITS - 1;
+    Uint64 mantissa = (1 << PROFILE_SUB_BITS) + (bucket & ((1 << PROFILE_SUB_BITS) - 1));
+    return mantissa << (exponent - PROFILE_SUB_BITS);
+}
+
+// Counts the time since profile_begin() against a phase
+void profile_end(int phase, Uint64 start) {
+    if (!SDL_GetAtomicInt(&profiling)) return;
+    double ns = (SDL_GetPerformanceCounter() - start) * profile_ns_per_tick;
+    SDL_AddAtomicInt(&profile_histograms[phase][profile_bucket(ns >= UINT32_MAX ? UINT32_MAX : (Uint32)ns)], 1);
+}
+
+// Duration in ns below which the given fraction of a phase's samples fall,
+// at the middle of its bucket. *samples receives the number of samples.
+double profile_percentile(int phase, double fraction, long *samples) {
+    long counts[PROFILE_BUCKETS];
+    long total = 0;
+    for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+        counts[bucket] = SDL_GetAtomicInt(&profile_histograms[phase][bucket]);
+        total += counts[bucket];
+    }
+    *samples = total;
+    if (total == 0) return 0;
+
+    long rank = (long)ceil(fraction * total), seen = 0;
+    int bucket = 0;
+    while (bucket < PROFILE_BUCKETS - 1 && (seen += counts[bucket]) < rank) bucket++;
+    return (profile_bucket_low(bucket) + profile_bucket_low(bucket + 1)) / 2.0;
+}
+
+// Every non-empty bucket of every phase, one per line. Returns false if the file can't be written.
+bool write_profile_csv(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return false;
+    fprintf(fp, "phase,low_ns,high_ns,count\n");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+            int count = SDL_GetAtomicInt(&profile_histograms[phase][bucket]);
+            if (count == 0) continue;
+            fprintf(fp, "%s,%llu,%llu,%d\n", phase_names[phase], (unsigned long long)profile_bucket_low(bucket),
+                    (unsigned long long)profile_bucket_low(bucket + 1), count);
+        }
+    }
+    return fclose(fp) == 0;
+}
+
+void print_profile_report() {
+    printf("Phase timings (p50 / p99):\n");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        long samples;
+        double p50 = profile_percentile(phase, 0.5, &samples);
+        if (samples == 0) continue;
+        printf("    %-16s %9.1f us / %9.1f us over %ld calls\n", phase_names[phase], p50 / 1000,
+               profile_percentile(phase, 0.99, &samples) / 1000, samples);
+    }
+    if (write_profile_csv(PROFILE_CSV)) {
+        printf("Phase histograms written to %s\n", PROFILE_CSV);
+    } else {
+        printf("Cannot write %s\n", PROFILE_CSV);
+    }
+}
+
+// Keeps file I/O and parsing off the render loop; the loop only picks up
+// finished batches through spawn_pending_vehicles()
+int ingest_thread_main(void *data) {
+    SourceWatch *watch = data;
+    while (SDL_GetAtomicInt(&ingest_running)) {
+        Uint64 start = profile_begin();
+        read_vehicle_source();
+        profile_end(PHASE_INGEST, start);
+        if (watch->active) {
+            wait_for_source(watch, INGEST_WAIT_MS);
+        } else {
+            SDL_WaitSemaphoreTimeout(ingest_wakeup, INGEST_POLL_MS);
+        }
+    }
+    return 0;
+}
+
+// Frame-to-frame time, to see hitches and jitter (Welford's running variance)
+typedef struct {
+    long frames;
+    double mean_ms;
+    double m2;
+    double max_ms;
+    long hitches;
+    long histogram[FRAME_BUCKETS]; // Frames by duration, FRAME_BUCKET_US wide
+} FrameStats;
+
+void record_frame_time(FrameStats *stats, double frame_ms) {
+    stats->frames++;
+    double delta = frame_ms - stats->mean_ms;
+    stats->mean_ms += delta / stats->frames;
+    stats->m2 += delta * (frame_ms - stats->mean_ms);
+    if (frame_ms > stats->max_ms) stats->max_ms = frame_ms;
+    if (frame_ms > HITCH_MS) stats->hitches++;
+    int bucket = (int)(frame_ms * 1000 / FRAME_BUCKET_US);
+    stats->histogram[SDL_clamp(bucket, 0, FRAME_BUCKETS - 1)]++;
+}
+
+// Frame time below which the given fraction of frames fall, to the bucket width
+double frame_percentile(const FrameStats *stats, double fraction) {
+    long rank = (long)ceil(fraction * stats->frames), seen = 0;
+    for (int bucket = 0; bucket < FRAME_BUCKETS; bucket++) {
+        seen += stats->histogram[bucket];
+        if (seen >= rank) return (bucket + 1) * FRAME_BUCKET_US / 1000.0;
+    }
+    return stats->max_ms;
+}
+
+void print_frame_stats(const FrameStats *stats) {
+    if (stats->frames < 2) return;
+    printf("Frame time over %ld frames: mean %.2f ms, stddev %.2f ms, max %.2f ms, %ld frames over %d ms\n",
+           stats->frames, stats->mean_ms, sqrt(stats->m2 / (stats->frames - 1)), stats->max_ms,
+           stats->hitches, HITCH_MS);
+    printf("Frame time percentiles: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, p99.9 %.1f ms\n",
+           frame_percentile(stats, 0.5), frame_percentile(stats, 0.9), frame_percentile(stats, 0.99),
+           frame_percentile(stats, 0.999));
+}
+
+// Keeps frames to the display's refresh rate: with vsync if the renderer
+// can do it, since presenting then waits for the display anyway, or else
+// by sleeping until each frame's deadline. SDL_DelayNS() tends to wake a
+// little late, so it is asked to wake early by the overshoot seen so far
+// and the rest is spun off.
+typedef struct {
+    bool vsync;
+    bool uncapped;        // --uncapped: as fast as possible, for benchmarking
+    Uint64 period_ns;
+    Uint64 deadline_ns;   // When the next frame is due
+    Uint64 overshoot_ns;  // How late a sleep usually wakes
+} FramePacer;
+
+void frame_pacer_init(FramePacer *pacer, SDL_Window *window, SDL_Renderer *renderer, bool uncapped) {
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->uncapped = uncapped;
+    int vsync = 0;
+    if (uncapped) {
+        SDL_SetRenderVSync(renderer, 0);
+    } else if (SDL_SetRenderVSync(renderer, 1) && SDL_GetRenderVSync(renderer, &vsync)) {
+        pacer->vsync = vsync != 0;
+    }
+
+    const SDL_DisplayMode *mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(window));
+    float refresh_hz = mode && mode->refresh_rate > 0 ? mode->refresh_rate : DEFAULT_REFRESH_HZ;
+    pacer->period_ns = (Uint64)(SDL_NS_PER_SECOND / refresh_hz);
+    pacer->deadline_ns = SDL_GetTicksNS();
+}
+
+// Call once a frame has been presented
+void frame_pacer_wait(FramePacer *pacer) {
+    if (pacer->vsync || pacer->uncapped) return;
+
+    pacer->deadline_ns += pacer->period_ns;
+    Uint64 now_ns = SDL_GetTicksNS();
+    if (now_ns >= pacer->deadline_ns) {
+        // Late: start the next frame now rather than rushing to make up for missed ones
+        if (now_ns - pacer->deadline_ns > pacer->period_ns) pacer->deadline_ns = now_ns;
+        return;
+    }
+
+    if (pacer->deadline_ns - now_ns > pacer->overshoot_ns) {
+        Uint64 wake_ns = pacer->deadline_ns - pacer->overshoot_ns;
+        SDL_DelayNS(wake_ns - now_ns);
+        now_ns = SDL_GetTicksNS();
+
+        // Learn quickly when sleeps run late, and forget slowly when they don't
+        Uint64 late_ns = now_ns > wake_ns ? now_ns - wake_ns : 0;
+        if (late_ns > pacer->overshoot_ns) {
+            pacer->overshoot_ns = (pacer->overshoot_ns + late_ns) / 2;
+        } else {
+            pacer->overshoot_ns -= pacer->overshoot_ns / 16;
+        }
+        pacer->overshoot_ns = SDL_min(pacer->overshoot_ns, pacer->period_ns / 2);
+    }
+    while (SDL_GetTicksNS() < pacer->deadline_ns) {
+        SDL_CPUPauseInstruction();
+    }
+}
+
+// distance is how far the vehicle drove, for the time it would have taken at DESIRED_SPEED
+void add_trip(TripStats *stats, double travel_s, float distance) {
+    double delay_s = travel_s - distance / DESIRED_SPEED;
+    if (delay_s < 0) delay_s = 0; // It entered at full speed and never had to brake
+
+    stats->trips++;
+    stats->total_travel_s += travel_s;
+    stats->total_delay_s += delay_s;
+    if (delay_s > stats->max_delay_s) stats->max_delay_s = delay_s;
+}
+
+// Counts the trip of the vehicle at the front of a lane, which just reached the center
+void record_trip(const LanePartition *partition) {
+    int i = partition->head;
+    add_trip(&trip_stats, (double)(simulation.time_ns - partition->born_ns[i]) / SDL_NS_PER_SECOND,
+             partition->exit_s - partition->born_s[i]);
+}
+
+void print_trip_stats(const TripStats *stats) {
+    if (stats->trips == 0) return;
+    printf("Completed %ld trips: mean travel time %.2f s, mean delay %.2f s, max delay %.2f s\n",
+           stats->trips, stats->total_travel_s / stats->trips,
+           stats->total_delay_s / stats->trips, stats->max_delay_s);
+}
+
+// Despawns the vehicle at the front of a lane
+void lane_pop(LanePartition *partition) {
+    bool waiting = partition->waiting[partition->head];
+    VehicleHandle handle = partition->handle[partition->head++];
+    const VehicleSlot *slot = pool_get(&vehicle_pool, handle);
+    if (waiting) traffic_light.vehicle_count[slot->road][slot->lane]--;
+    index_remove(&vehicle_index, vehicle_key(slot->producer, slot->id));
+    pool_free(&vehicle_pool, handle);
+    vehicle_count--;
+}
+
+void clear_vehicles() {
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            LanePartition *partition = &lanes[road][lane];
+            while (partition->head < partition->count) lane_pop(partition);
+            lane_trim(partition);
+        }
+    }
+}
+
+// Intelligent Driver Model: speed up towards DESIRED_SPEED, brake for
+// whatever is closest ahead. On red, the stop line counts as a stationary
+// vehicle until this one has crossed it. Written with selects rather than
+// branches so the lane loop vectorizes.
+float idm_acceleration(float s, float v, float leader_gap, float leader_v, bool red, float stop_s) {
+    float line_gap = stop_s - s;
+    line_gap = red & (s < stop_s) ? line_gap : FREE_ROAD;
+    bool line_first = line_gap < leader_gap;
+    float gap = line_first ? line_gap : leader_gap;
+    gap = gap > 0.1f ? gap : 0.1f;
+    float closing = v - (line_first ? 0.0f : leader_v);
+
+    float dynamic_gap = v * TIME_HEADWAY + v * closing * (0.5f / sqrtf(MAX_ACCEL * COMFORT_DECEL));
+    float desired_gap = MIN_GAP + (dynamic_gap > 0.0f ? dynamic_gap : 0.0f);
+    float speed_ratio = v * (1.0f / DESIRED_SPEED);
+    float speed_ratio2 = speed_ratio * speed_ratio;
+    float gap_ratio = desired_gap / gap;
+    return MAX_ACCEL * (1.0f - speed_ratio2 * speed_ratio2 - gap_ratio * gap_ratio);
+}
+
+// Steps one lane's vehicles [0, n), front first: IDM accelerations into
+// accel, all from the same snapshot, then speeds and positions
+typedef void (*LaneKernelFn)(float *s, float *v, float *accel, int n, bool red, float stop_s, float delta_time);
+
+// Reference version, and the fallback on CPUs without SSE2
+void lane_kernel_scalar(float *s, float *v, float *accel, int n, bool red, float stop_s, float delta_time) {
+    accel[0] = idm_acceleration(s[0], v[0], FREE_ROAD, 0.0f, red, stop_s);
+    for (int i = 1; i < n; i++) {
+        accel[i] = idm_acceleration(s[i], v[i], s[i - 1] - s[i] - VEHICLE_SIZE, v[i - 1], red, stop_s);
+    }
+
+    // Speeds never go negative
+    for (int i = 0; i < n; i++) {
+        float speed = v[i] + accel[i] * delta_time;
+        speed = speed > 0.0f ? speed : 0.0f;
+        s[i] += speed * delta_time;
+        v[i] = speed;
+    }
+}
+
+// The SIMD kernels do the same operations in the same order as
+// idm_acceleration(), so they match the scalar kernel bit for bit unless
+// the compiler fuses multiply-adds in one of them
+#ifdef SDL_SSE2_INTRINSICS
+SDL_TARGETING("sse2") __m128 idm_acceleration_sse2(__m128 s, __m128 v, __m128 leader_gap, __m128 leader_v,
+                                                    __m128 red, __m128 stop_s) {
+    __m128 line_ahead = _mm_and_ps(red, _mm_cmplt_ps(s, stop_s));
+    __m128 line_gap = _mm_or_ps(_mm_and_ps(line_ahead, _mm_sub_ps(stop_s, s)),
+                                _mm_andnot_ps(line_ahead, _mm_set1_ps(FREE_ROAD)));
+    __m128 line_first = _mm_cmplt_ps(line_gap, leader_gap);
+    __m128 gap = _mm_or_ps(_mm_and_ps(line_first, line_gap), _mm_andnot_ps(line_first, leader_gap));
+    gap = _mm_max_ps(gap, _mm_set1_ps(0.1f));
+    __m128 closing = _mm_sub_ps(v, _mm_andnot_ps(line_first, leader_v));
+
+    __m128 dynamic_gap = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(TIME_HEADWAY)),
+                                    _mm_mul_ps(_mm_mul_ps(v, closing), _mm_set1_ps(0.5f / sqrtf(MAX_ACCEL * COMFORT_DECEL))));
+    __m128 desired_gap = _mm_add_ps(_mm_set1_ps(MIN_GAP), _mm_max_ps(dynamic_gap, _mm_setzero_ps()));
+    __m128 speed_ratio = _mm_mul_ps(v, _mm_set1_ps(1.0f / DESIRED_SPEED));
+    __m128 speed_ratio2 = _mm_mul_ps(speed_ratio, speed_ratio);
+    __m128 gap_ratio = _mm_div_ps(desired_gap, gap);
+    __m128 free_term = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(speed_ratio2, speed_ratio2));
+    return _mm_mul_ps(_mm_set1_ps(MAX_ACCEL), _mm_sub_ps(free_term, _mm_mul_ps(gap_ratio, gap_ratio)));
+}
+
+SDL_TARGETING("sse2") void lane_kernel_sse2(float *s, float *v, float *accel, int n, bool red, float stop_s,
+                                             float delta_time) {
+    __m128 red_mask = _mm_castsi128_ps(_mm_set1_epi32(red ? -1 : 0));
+    __m128 stop = _mm_set1_ps(stop_s);
+    __m128 length = _mm_set1_ps(VEHICLE_SIZE);
+
+    accel[0] = idm_acceleration(s[0], v[0], FREE_ROAD, 0.0f, red, stop_s);
+    int i = 1;
+    for (; i + 4 <= n; i += 4) {
+        // Each vehicle's leader is the one before it, so load the same arrays shifted by one
+        __m128 pos = _mm_loadu_ps(s + i);
+        __m128 leader_gap = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(s + i - 1), pos), length);
+        _mm_storeu_ps(accel + i, idm_acceleration_sse2(pos, _mm_loadu_ps(v + i), leader_gap,
+                                                       _mm_loadu_ps(v + i - 1), red_mask, stop));
+    }
+    for (; i < n; i++) {
+        accel[i] = idm_acceleration(s[i], v[i], s[i - 1] - s[i] - VEHICLE_SIZE, v[i - 1], red, stop_s);
+    }
+
+    __m128 dt = _mm_set1_ps(delta_time);
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 speed = _mm_max_ps(_mm_add_ps(_mm_loadu_ps(v + i), _mm_mul_ps(_mm_loadu_ps(accel + i), dt)),
+                                  _mm_setzero_ps());
+        _mm_storeu_ps(s + i, _mm_add_ps(_mm_loadu_ps(s + i), _mm_mul_ps(speed, dt)));
+        _mm_storeu_ps(v + i, speed);
+    }
+    for (; i < n; i++) {
+        float speed = v[i] + accel[i] * delta_time;
+        speed = speed > 0.0f ? speed : 0.0f;
+        s[i] += speed * delta_time;
+        v[i] = speed;
+    }
+}
+#endif
+
+#ifdef SDL_AVX2_INTRINSICS
+SDL_TARGETING("avx2") __m256 idm_acceleration_avx2(__m256 s, __m256 v, __m256 leader_gap, __m256 leader_v,
+                                                    __m256 red, __m256 stop_s) {
+    __m256 line_ahead = _mm256_and_ps(red, _mm256_cmp_ps(s, stop_s, _CMP_LT_OQ));
+    __m256 line_gap = _mm256_blendv_ps(_mm256_set1_ps(FREE_ROAD), _mm256_sub_ps(stop_s, s), line_ahead);
+    __m256 line_first = _mm256_cmp_ps(line_gap, leader_gap, _CMP_LT_OQ);
+    __m256 gap = _mm256_max_ps(_mm256_blendv_ps(leader_gap, line_gap, line_first), _mm256_set1_ps(0.1f));
+    __m256 closing = _mm256_sub_ps(v, _mm256_andnot_ps(line_first, leader_v));
+
+    __m256 dynamic_gap = _mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(TIME_HEADWAY)),
+                                       _mm256_mul_ps(_mm256_mul_ps(v, closing),
+                                                     _mm256_set1_ps(0.5f / sqrtf(MAX_ACCEL * COMFORT_DECEL))));
+    __m256 desired_gap = _mm256_add_ps(_mm256_set1_ps(MIN_GAP), _mm256_max_ps(dynamic_gap, _mm256_setzero_ps()));
+    __m256 speed_ratio = _mm256_mul_ps(v, _mm256_set1_ps(1.0f / DESIRED_SPEED));
+    __m256 speed_ratio2 = _mm256_mul_ps(speed_ratio, speed_ratio);
+    __m256 gap_ratio = _mm256_div_ps(desired_gap, gap);
+    __m256 free_term = _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(speed_ratio2, speed_ratio2));
+    return _mm256_mul_ps(_mm256_set1_ps(MAX_ACCEL), _mm256_sub_ps(free_term, _mm256_mul_ps(gap_ratio, gap_ratio)));
+}
+
+SDL_TARGETING("avx2") void lane_kernel_avx2(float *s, float *v, float *accel, int n, bool red, float stop_s,
+                                             float delta_time) {
+    __m256 red_mask = _mm256_castsi256_ps(_mm256_set1_epi32(red ? -1 : 0));
+    __m256 stop = _mm256_set1_ps(stop_s);
+    __m256 length = _mm256_set1_ps(VEHICLE_SIZE);
+
+    accel[0] = idm_acceleration(s[0], v[0], FREE_ROAD, 0.0f, red, stop_s);
+    int i = 1;
+    for (; i + 8 <= n; i += 8) {
+        __m256 pos = _mm256_loadu_ps(s + i);
+        __m256 leader_gap = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(s + i - 1), pos), length);
+        _mm256_storeu_ps(accel + i, idm_acceleration_avx2(pos, _mm256_loadu_ps(v + i), leader_gap,
+                                                          _mm256_loadu_ps(v + i - 1), red_mask, stop));
+    }
+    for (; i < n; i++) {
+        accel[i] = idm_acceleration(s[i], v[i], s[i - 1] - s[i] - VEHICLE_SIZE, v[i - 1], red, stop_s);
+    }
+
+    __m256 dt = _mm256_set1_ps(delta_time);
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 speed = _mm256_max_ps(_mm256_add_ps(_mm256_loadu_ps(v + i), _mm256_mul_ps(_mm256_loadu_ps(accel + i), dt)),
+                                     _mm256_setzero_ps());
+        _mm256_storeu_ps(s + i, _mm256_add_ps(_mm256_loadu_ps(s + i), _mm256_mul_ps(speed, dt)));
+        _mm256_storeu_ps(v + i, speed);
+    }
+    for (; i < n; i++) {
+        float speed = v[i] + accel[i] * delta_time;
+        speed = speed > 0.0f ? speed : 0.0f;
+        s[i] += speed * delta_time;
+        v[i] = speed;
+    }
+}
+#endif
+
+// Fastest first; the first one the CPU supports is used unless --kernel picks another
+typedef struct {
+    const char *name;
+    LaneKernelFn run;
+    bool (*supported)(void); // NULL if it runs everywhere
+} LaneKernel;
+
+const LaneKernel lane_kernels[] = {
+#ifdef SDL_AVX2_INTRINSICS
+    {"avx2", lane_kernel_avx2, SDL_HasAVX2},
+#endif
+#ifdef SDL_SSE2_INTRINSICS
+    {"sse2", lane_kernel_sse2, SDL_HasSSE2},
+#endif
+    {"scalar", lane_kernel_scalar, NULL},
+};
+#define LANE_KERNEL_COUNT (int)(sizeof(lane_kernels) / sizeof(lane_kernels[0]))
+
+const LaneKernel *lane_kernel = &lane_kernels[LANE_KERNEL_COUNT - 1];
+
+bool lane_kernel_supported(const LaneKernel *kernel) {
+    return !kernel->supported || kernel->supported();
+}
+
+// Picks the named kernel, or the fastest supported one if name is NULL.
+// Returns false if the name is unknown or the CPU can't run it.
+bool select_lane_kernel(const char *name) {
+    for (int k = 0; k < LANE_KERNEL_COUNT; k++) {
+        if (name ? strcmp(lane_kernels[k].name, name) == 0 : lane_kernel_supported(&lane_kernels[k])) {
+            if (!lane_kernel_supported(&lane_kernels[k])) return false;
+            lane_kernel = &lane_kernels[k];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs every supported kernel on the same random lanes as the scalar
+// reference and compares the resulting positions and speeds. Returns false
+// if any kernel drifts by more than KERNEL_TOLERANCE.
+bool check_lane_kernels(int lane_count, bool verbose) {
+    enum { MAX_LANE = 100 };
+    float s[MAX_LANE], v[MAX_LANE], accel[MAX_LANE];
+    float expected_s[MAX_LANE], expected_v[MAX_LANE], actual_s[MAX_LANE], actual_v[MAX_LANE];
+    bool ok = true;
+
+    for (int k = 0; k < LANE_KERNEL_COUNT; k++) {
+        const LaneKernel *kernel = &lane_kernels[k];
+        if (kernel->run == lane_kernel_scalar || !lane_kernel_supported(kernel)) continue;
+
+        srand(12345); // Every kernel sees the same lanes
+        float max_diff = 0;
+        int identical = 0;
+        for (int l = 0; l < lane_count; l++) {
+            // A queue in any state: overlapping, bunched up or spread out,
+            // on either side of the stop line, with the light either way
+            int n = 1 + rand() % MAX_LANE;
+            bool red = rand() % 2;
+            float stop_s = 200.0f + rand() % 40;
+            s[0] = -100.0f + rand() % 500;
+            for (int i = 0; i < n; i++) {
+                if (i > 0) s[i] = s[i - 1] - VEHICLE_SIZE + (rand() % 1000) / 10.0f - 10.0f;
+                v[i] = (rand() % 1500) / 10.0f;
+            }
+            float delta_time = (1 + rand() % 50) / 1000.0f;
+
+            memcpy(expected_s, s, n * sizeof(float));
+            memcpy(expected_v, v, n * sizeof(float));
+            lane_kernel_scalar(expected_s, expected_v, accel, n, red, stop_s, delta_time);
+            memcpy(actual_s, s, n * sizeof(float));
+            memcpy(actual_v, v, n * sizeof(float));
+            kernel->run(actual_s, actual_v, accel, n, red, stop_s, delta_time);
+
+            identical += memcmp(expected_s, actual_s, n * sizeof(float)) == 0 &&
+                         memcmp(expected_v, actual_v, n * sizeof(float)) == 0;
+            for (int i = 0; i < n; i++) {
+                float diff = fmaxf(fabsf(expected_s[i] - actual_s[i]), fabsf(expected_v[i] - actual_v[i]));
+                if (diff > max_diff) max_diff = diff;
+            }
+        }
+
+        if (max_diff > KERNEL_TOLERANCE) ok = false;
+        if (verbose || max_diff > KERNEL_TOLERANCE) {
+            printf("%s kernel: %d of %d lanes bit-identical to scalar, max difference %g%s\n", kernel->name,
+                   identical, lane_count, max_diff, max_diff > KERNEL_TOLERANCE ? " (TOO LARGE)" : "");
+        }
+    }
+    return ok;
+}
+
+// Moves every vehicle in a lane on by one step, *scratch holding the
+// accelerations in between. Returns how many more vehicles the red light
+// holds than before the step, or 0 if out of memory, in which case the lane
+// stands still. Nobody overtakes, so afterwards whoever reached the center
+// is at the front, for the caller to take off.
+int lane_step(LanePartition *partition, bool red, float delta_time, float **scratch, int *scratch_capacity) {
+    int head = partition->head;
+    int count = partition->count;
+    if (head == count) return 0;
+
+    if (count - head > *scratch_capacity) {
+        float *accel = realloc(*scratch, partition->capacity * sizeof(float));
+        if (!accel) return 0;
+        *scratch = accel;
+        *scratch_capacity = partition->capacity;
+    }
+
+    float *restrict s = partition->s;
+    uint8_t *restrict waiting = partition->waiting;
+    float stop_s = partition->stop_s;
+
+    // Waiting means held by the red light, same as before
+    int stopped = 0;
+    for (int i = head; i < count; i++) {
+        uint8_t held = red & (s[i] < stop_s);
+        stopped += held - waiting[i];
+        waiting[i] = held;
+    }
+    lane_kernel->run(s + head, partition->v + head, *scratch, count - head, red, stop_s, delta_time);
+    return stopped;
+}
+
+void update_vehicles(float delta_time) {
+    for (int road = 0; road < 4; road++) {
+        bool red = !traffic_light.green[road];
+        for (int lane = 0; lane < 3; lane++) {
+            LanePartition *partition = &lanes[road][lane];
+            int head = partition->head;
+            int stopped = lane_step(partition, red, delta_time, &accel_scratch, &accel_scratch_capacity);
+
+            int *waiting_count = &traffic_light.vehicle_count[road][lane];
+            if (lane == 2 && *waiting_count < PRIORITY_THRESHOLD && *waiting_count + stopped >= PRIORITY_THRESHOLD) {
+                priority_threshold_crossed = true;
+            }
+            *waiting_count += stopped;
+
+            while (partition->head < partition->count && partition->s[partition->head] > partition->exit_s) {
+                record_trip(partition);
+                lane_pop(partition);
+            }
+            if (partition->head != head) lane_trim(partition);
+        }
+    }
+}
+
+// Remembers where everyone is before the last step of a frame, so drawing
+// can blend between that and the step's result
+void save_previous_positions() {
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            LanePartition *partition = &lanes[road][lane];
+            memcpy(partition->prev_s + partition->head, partition->s + partition->head,
+                   (partition->count - partition->head) * sizeof(float));
+        }
+    }
+}
+
+void simulation_init(int hz) {
+    memset(&simulation, 0, sizeof(simulation));
+    simulation.step_ns = SDL_NS_PER_SECOND / hz;
+    simulation.step_seconds = (float)simulation.step_ns / SDL_NS_PER_SECOND;
+}
+
+// Whether the lights are due their regular update, every 2 simulated seconds
+bool lights_due(Uint64 time_ns, Uint64 last_update_ns) {
+    return time_ns - last_update_ns > SDL_MS_TO_NS(2000);
+}
+
+// Advances the simulation by one fixed step
+void simulation_step() {
+    // Update traffic lights every 2 simulated seconds, or with --reactive
+    // as soon as a priority lane reaches the threshold
+    if (lights_due(simulation.time_ns, simulation.last_light_update_ns) ||
+        (simulation.reactive_lights && priority_threshold_crossed)) {
+        Uint64 start = profile_begin();
+        update_traffic_lights();
+        profile_end(PHASE_LIGHTS, start);
+        simulation.last_light_update_ns = simulation.time_ns;
+    }
+
+    // Vehicles that leave during the step are timed at its end
+    simulation.time_ns += simulation.step_ns;
+    simulation.steps++;
+    Uint64 start = profile_begin();
+    update_vehicles(simulation.step_seconds);
+    profile_end(PHASE_VEHICLES, start);
+}
+
+// A recorded stream of arrivals to replay with --headless
+typedef struct {
+    VehicleLogEntry entry;
+    Uint64 arrival_ns; // Simulated time it shows up at the edge of the window
+    long order;        // Position in the file, to keep ties in file order
+} TraceArrival;
+
+typedef struct {
+    TraceArrival *arrivals;
+    long count;
+    long capacity;
+    long next;         // First arrival not on the roads yet
+    bool timestamped;  // Every record had an arrival time
+    int skipped;       // Corrupt records or malformed lines
+} ArrivalTrace;
+
+void trace_append(const VehicleLogEntry *entry, void *context) {
+    ArrivalTrace *trace = context;
+    if (trace->count == trace->capacity) {
+        long capacity = trace->capacity ? trace->capacity * 2 : 1024;
+        TraceArrival *arrivals = realloc(trace->arrivals, capacity * sizeof(TraceArrival));
+        if (!arrivals) return; // Out of memory: the rest of the trace is dropped
+        trace->arrivals = arrivals;
+        trace->capacity = capacity;
+    }
+
+    TraceArrival *arrival = &trace->arrivals[trace->count];
+    arrival->entry = *entry;
+    arrival->order = trace->count++;
+    if (entry->arrival_us == 0) trace->timestamped = false;
+}
+
+int compare_arrivals(const void *a, const void *b) {
+    const TraceArrival *x = a, *y = b;
+    if (x->arrival_ns != y->arrival_ns) return x->arrival_ns < y->arrival_ns ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+// Reads a whole binary or text vehicle log as a trace. Arrival times are
+// taken from the records, relative to the first one, or spaced
+// TRACE_SPACING_MS apart in file order if any record lacks a timestamp.
+// Returns false if the file can't be read.
+bool load_arrival_trace(ArrivalTrace *trace, const char *path) {
+    memset(trace, 0, sizeof(*trace));
+    trace->timestamped = true;
+
+    VehicleLogMap map;
+    if (vehicle_log_map(&map, path) && vehicle_log_check_header(map.data, map.size)) {
+        for (size_t offset = sizeof(VehicleLogHeader); offset + sizeof(VehicleLogRecord) <= map.size;
+             offset += sizeof(VehicleLogRecord)) {
+            VehicleLogEntry entry;
+            if (vehicle_log_decode((const VehicleLogRecord *)(map.data + offset), &entry)) {
+                trace_append(&entry, trace);
+            } else {
+                trace->skipped++;
+            }
+        }
+        vehicle_log_unmap(&map);
+    } else {
+        vehicle_log_unmap(&map);
+        FILE *fp = fopen(path, "r");
+        if (!fp) return false;
+        bool ok = vehicle_log_read_text_file(fp, trace_append, trace, &trace->skipped) >= 0;
+        fclose(fp);
+        if (!ok) {
+            free(trace->arrivals);
+            return false;
+        }
+    }
+
+    uint64_t first_us = UINT64_MAX;
+    for (long i = 0; i < trace->count; i++) {
+        if (trace->arrivals[i].entry.arrival_us < first_us) first_us = trace->arrivals[i].entry.arrival_us;
+    }
+    for (long i = 0; i < trace->count; i++) {
+        TraceArrival *arrival = &trace->arrivals[i];
+        arrival->arrival_ns = trace->timestamped ? SDL_US_TO_NS(arrival->entry.arrival_us - first_us)
+                                                 : (Uint64)i * SDL_MS_TO_NS(TRACE_SPACING_MS);
+    }
+    qsort(trace->arrivals, trace->count, sizeof(TraceArrival), compare_arrivals);
+    return true;
+}
+
+// Discrete-event engine for --engine event. Instead of stepping every
+// vehicle 120 times a second it jumps from one event to the next:
+//
+//   EVENT_ARRIVAL       a vehicle from the trace enters its lane
+//   EVENT_STOP_LINE     the front vehicle of a lane crosses the stop line
+//   EVENT_LIGHT_CHANGE  the lights are re-planned, on the same schedule as simulation_step()
+//   EVENT_CLEAR         a vehicle reaches the center and its trip ends
+//
+// Vehicles cruise at DESIRED_SPEED unless a red light or the queue ahead
+// holds them up. Queues discharge with the start-up delay, headway and
+// clearing time measured from the IDM at startup, so delays match the
+// stepped engine without simulating anyone's braking in between. Waiting
+// counts follow the same rule as the stepped engine (held by a red light
+// before the stop line), so the lights make the same decisions.
+enum { EVENT_ARRIVAL, EVENT_STOP_LINE, EVENT_LIGHT_CHANGE, EVENT_CLEAR };
+
+typedef struct {
+    Uint64 time_ns;
+    uint64_t order;  // Insertion order, so events at the same time run first come first served
+    int type;
+    long vehicle;    // Index into the trace, -1 for light changes
+    uint32_t plan;   // Ignored if the vehicle or lights were re-planned since it was queued
+} SimEvent;
+
+// Binary min-heap on time
+typedef struct {
+    SimEvent *events;
+    long count;
+    long capacity;
+    uint64_t next_order;
+} EventQueue;
+
+bool event_before(const SimEvent *a, const SimEvent *b) {
+    return a->time_ns != b->time_ns ? a->time_ns < b->time_ns : a->order < b->order;
+}
+
+// Returns false if out of memory
+bool event_queue_push(EventQueue *queue, Uint64 time_ns, int type, long vehicle, uint32_t plan) {
+    if (queue->count == queue->capacity) {
+        long capacity = queue->capacity ? queue->capacity * 2 : 256;
+        SimEvent *events = realloc(queue->events, capacity * sizeof(SimEvent));
+        if (!events) return false;
+        queue->events = events;
+        queue->capacity = capacity;
+    }
+
+    SimEvent event = {time_ns, queue->next_order++, type, vehicle, plan};
+    long i = queue->count++;
+    while (i > 0 && event_before(&event, &queue->events[(i - 1) / 2])) {
+        queue->events[i] = queue->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->events[i] = event;
+    return true;
+}
+
+SimEvent event_queue_pop(EventQueue *queue) {
+    SimEvent top = queue->events[0];
+    SimEvent last = queue->events[--queue->count];
+    long i = 0;
+    for (;;) {
+        long child = 2 * i + 1;
+        if (child >= queue->count) break;
+        if (child + 1 < queue->count && event_before(&queue->events[child + 1], &queue->events[child])) child++;
+        if (!event_before(&queue->events[child], &last)) break;
+        queue->events[i] = queue->events[child];
+        i = child;
+    }
+    if (queue->count > 0) queue->events[i] = last;
+    return top;
+}
+
+typedef struct {
+    Uint64 enter_ns;
+    Uint64 free_cross_ns; // When it would reach the stop line on an open road
+    float spawn_s;        // Behind the window edge if it joined a queue reaching back that far
+    Uint64 cross_ns;      // When it is due to cross, while a crossing is planned
+    Uint64 remaining_ns;  // Pull-away left when a red light cut it short, 0 if none
+    uint32_t plan;
+    bool held;            // Stopped by the light or the queue, so it pulls away from a standstill
+} EventVehicle;
+
+// Vehicles that haven't crossed the stop line yet, front first
+typedef struct {
+    long *queue;
+    int head;
+    int count;
+    int capacity;
+    Uint64 last_cross_ns; // When the previous vehicle crossed
+    bool last_held;
+    bool crossed_any;
+} EventLane;
+
+typedef struct {
+    EventQueue queue;
+    EventVehicle *vehicles; // One per trace arrival
+    EventLane lanes[4][3];
+    Uint64 green_since[4];
+    uint32_t light_plan;
+    Uint64 last_light_update_ns;
+    int in_system;          // Entered and not cleared yet, for --capacity
+    long arrival_scheduled; // Trace index the pending EVENT_ARRIVAL is for, -1 if none
+    long events;
+
+    // Measured from the IDM by calibrate_event_engine()
+    Uint64 startup_ns[4][3];    // Green to the first queued vehicle crossing the stop line
+    Uint64 saturation_ns[4][3]; // Between queued vehicles crossing once the queue moves
+    Uint64 follow_ns;           // Between vehicles crossing at full speed
+    Uint64 approach_ns[4][3];   // Window edge to stop line at full speed
+    Uint64 clear_free_ns[4][3]; // Stop line to center at full speed
+    Uint64 clear_held_ns[4][3]; // Stop line to center after starting from a standstill
+} EventEngine;
+
+// Times a queue of stopped vehicles pulling away from a green light with
+// the same kernel and step as the stepped engine. Needs init_lanes().
+void calibrate_event_engine(EventEngine *engine) {
+    enum { QUEUE = 10 };
+    float s[QUEUE], v[QUEUE], accel[QUEUE];
+    Uint64 cross[QUEUE], clear[QUEUE];
+
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            const LanePartition *partition = &lanes[road][lane];
+            for (int i = 0; i < QUEUE; i++) {
+                s[i] = partition->stop_s - MIN_GAP - i * (VEHICLE_SIZE + MIN_GAP);
+                v[i] = 0;
+                cross[i] = clear[i] = 0;
+            }
+
+            Uint64 time_ns = 0;
+            while (clear[QUEUE - 1] == 0 && time_ns < SDL_MS_TO_NS(60000)) {
+                lane_kernel_scalar(s, v, accel, QUEUE, false, partition->stop_s, simulation.step_seconds);
+                time_ns += simulation.step_ns;
+                for (int i = 0; i < QUEUE; i++) {
+                    if (!cross[i] && s[i] >= partition->stop_s) cross[i] = time_ns;
+                    if (!clear[i] && s[i] > partition->exit_s) clear[i] = time_ns;
+                }
+            }
+
+            Uint64 clear_total = 0;
+            for (int i = 0; i < QUEUE; i++) clear_total += clear[i] - cross[i];
+            engine->clear_held_ns[road][lane] = clear_total / QUEUE;
+            engine->clear_free_ns[road][lane] =
+                (Uint64)((partition->exit_s - partition->stop_s) / DESIRED_SPEED * SDL_NS_PER_SECOND);
+            engine->approach_ns[road][lane] = (Uint64)(partition->stop_s / DESIRED_SPEED * SDL_NS_PER_SECOND);
+            engine->startup_ns[road][lane] = cross[0];
+            engine->saturation_ns[road][lane] = (cross[QUEUE - 1] - cross[0]) / (QUEUE - 1);
+        }
+    }
+
+    // Bumper to bumper at the IDM's desired gap for full speed
+    engine->follow_ns = (Uint64)((VEHICLE_SIZE + MIN_GAP + DESIRED_SPEED * TIME_HEADWAY) / DESIRED_SPEED *
+                                 SDL_NS_PER_SECOND);
+}
+
+// The stepped engine only looks at the clock at step boundaries
+Uint64 next_step_time(Uint64 time_ns) {
+    return (time_ns / simulation.step_ns + 1) * simulation.step_ns;
+}
+
+// Schedules the front vehicle of a lane to cross the stop line, if its light is green
+void plan_stop_line(EventEngine *engine, int road, int lane, Uint64 now) {
+    EventLane *event_lane = &engine->lanes[road][lane];
+    if (event_lane->head == event_lane->count || !traffic_light.green[road]) return;
+
+    long index = event_lane->queue[event_lane->head];
+    EventVehicle *vehicle = &engine->vehicles[index];
+    Uint64 green_ns = engine->green_since[road];
+
+    // Got to the line while it was red: pull away once it turned green,
+    // carrying on where it left off if the last green was too short
+    Uint64 cross_ns = vehicle->free_cross_ns;
+    bool held = cross_ns <= green_ns;
+    if (held) cross_ns = green_ns + (vehicle->remaining_ns ? vehicle->remaining_ns : engine->startup_ns[road][lane]);
+
+    // Stay behind whoever crossed before, moving off as a queue if they did
+    if (event_lane->crossed_any) {
+        Uint64 behind_ns = event_lane->last_cross_ns + (event_lane->last_held ? engine->saturation_ns[road][lane] : engine->follow_ns);
+        if (cross_ns < behind_ns) {
+            cross_ns = behind_ns;
+            held = held || event_lane->last_held;
+        }
+    }
+    if (cross_ns < now) cross_ns = now;
+
+    vehicle->held = held;
+    vehicle->cross_ns = cross_ns;
+    event_queue_push(&engine->queue, cross_ns, EVENT_STOP_LINE, index, ++vehicle->plan);
+}
+
+// Lets in everyone from the trace who is due by now, while there is room
+void admit_arrivals(EventEngine *engine, ArrivalTrace *trace, Uint64 now) {
+    while (trace->next < trace->count && (vehicle_capacity <= 0 || engine->in_system < vehicle_capacity)) {
+        const TraceArrival *arrival = &trace->arrivals[trace->next];
+        Uint64 enter_ns = arrival->arrival_ns == 0 ? 0 : next_step_time(arrival->arrival_ns - 1);
+        if (enter_ns > now) {
+            if (engine->arrival_scheduled != trace->next) {
+                event_queue_push(&engine->queue, enter_ns, EVENT_ARRIVAL, trace->next, 0);
+                engine->arrival_scheduled = trace->next;
+            }
+            return;
+        }
+
+        int road = arrival->entry.road, lane = arrival->entry.lane;
+        EventLane *event_lane = &engine->lanes[road][lane];
+        EventVehicle *vehicle = &engine->vehicles[trace->next];
+        int ahead = event_lane->count - event_lane->head;
+        float queue_end = lanes[road][lane].stop_s - MIN_GAP - ahead * (VEHICLE_SIZE + MIN_GAP);
+        vehicle->enter_ns = now;
+        vehicle->free_cross_ns = now + engine->approach_ns[road][lane];
+        vehicle->spawn_s = queue_end < 0 ? queue_end : 0;
+        vehicle->remaining_ns = 0;
+        vehicle->plan = 0;
+        vehicle->held = false;
+
+        if (event_lane->count == event_lane->capacity) {
+            int live = event_lane->count - event_lane->head;
+            memmove(event_lane->queue, event_lane->queue + event_lane->head, live * sizeof(long));
+            event_lane->head = 0;
+            event_lane->count = live;
+            if (live == event_lane->capacity) {
+                int capacity = event_lane->capacity ? event_lane->capacity * 2 : 16;
+                long *queue = realloc(event_lane->queue, capacity * sizeof(long));
+                if (!queue) return; // Out of memory: try again on the next event
+                event_lane->queue = queue;
+                event_lane->capacity = capacity;
+            }
+        }
+        event_lane->queue[event_lane->count++] = trace->next;
+        if (event_lane->count - event_lane->head == 1) plan_stop_line(engine, road, lane, now);
+
+        engine->in_system++;
+        trace->next++;
+    }
+}
+
+void change_lights(EventEngine *engine, Uint64 now) {
+    // Supersedes the update that was planned before
+    engine->light_plan++;
+    engine->last_light_update_ns = now;
+
+    bool was_green[4];
+    for (int road = 0; road < 4; road++) {
+        was_green[road] = traffic_light.green[road];
+        for (int lane = 0; lane < 3; lane++) {
+            const EventLane *event_lane = &engine->lanes[road][lane];
+            traffic_light.vehicle_count[road][lane] = was_green[road] ? 0 : event_lane->count - event_lane->head;
+        }
+    }
+    plan_traffic_lights(&traffic_light);
+
+    for (int road = 0; road < 4; road++) {
+        if (traffic_light.green[road] == was_green[road]) continue;
+
+        for (int lane = 0; lane < 3; lane++) {
+            EventLane *event_lane = &engine->lanes[road][lane];
+            if (event_lane->head == event_lane->count) continue;
+            if (traffic_light.green[road]) {
+                engine->green_since[road] = now;
+                plan_stop_line(engine, road, lane, now);
+            } else {
+                // Not crossing after all
+                EventVehicle *front = &engine->vehicles[event_lane->queue[event_lane->head]];
+                if (front->held && front->cross_ns > now) {
+                    front->remaining_ns = SDL_min(front->cross_ns - now, engine->startup_ns[road][lane]);
+                }
+                front->plan++;
+            }
+        }
+    }
+
+    // Next regular update, at the first step more than 2 seconds from now
+    event_queue_push(&engine->queue, next_step_time(now + SDL_MS_TO_NS(2000)), EVENT_LIGHT_CHANGE, -1,
+                     engine->light_plan);
+}
+
+// Runs the trace through the event engine until end_ns or, if drain is
+// set, until the last vehicle has cleared. Returns the vehicles still in
+// the system and leaves the clock in simulation.time_ns.
+int run_event_engine(ArrivalTrace *trace, Uint64 end_ns, bool drain, long *events, double *total_entry_wait_s) {
+    EventEngine *engine = calloc(1, sizeof(EventEngine));
+    if (engine) engine->vehicles = calloc(trace->count > 0 ? trace->count : 1, sizeof(EventVehicle));
+    if (!engine || !engine->vehicles) {
+        printf("Out of memory for the event engine\n");
+        free(engine);
+        return 0;
+    }
+    engine->arrival_scheduled = -1;
+    calibrate_event_engine(engine);
+
+    admit_arrivals(engine, trace, 0);
+    event_queue_push(&engine->queue, next_step_time(SDL_MS_TO_NS(2000)), EVENT_LIGHT_CHANGE, -1, 0);
+
+    while (engine->queue.count > 0) {
+        if (drain && trace->next == trace->count && engine->in_system == 0) break;
+        if (engine->queue.events[0].time_ns >= end_ns) {
+            simulation.time_ns = end_ns;
+            break;
+        }
+
+        SimEvent event = event_queue_pop(&engine->queue);
+        simulation.time_ns = event.time_ns;
+        engine->events++;
+
+        if (event.type == EVENT_ARRIVAL) {
+            engine->arrival_scheduled = -1;
+            admit_arrivals(engine, trace, event.time_ns);
+        } else if (event.type == EVENT_LIGHT_CHANGE) {
+            if (event.plan == engine->light_plan) change_lights(engine, event.time_ns);
+        } else if (event.type == EVENT_STOP_LINE) {
+            EventVehicle *vehicle = &engine->vehicles[event.vehicle];
+            if (event.plan != vehicle->plan) continue;
+
+            const TraceArrival *arrival = &trace->arrivals[event.vehicle];
+            int road = arrival->entry.road, lane = arrival->entry.lane;
+            EventLane *event_lane = &engine->lanes[road][lane];
+            event_lane->head++;
+            event_lane->last_cross_ns = event.time_ns;
+            event_lane->last_held = vehicle->held;
+            event_lane->crossed_any = true;
+
+            Uint64 clear_ns = vehicle->held ? engine->clear_held_ns[road][lane] : engine->clear_free_ns[road][lane];
+            event_queue_push(&engine->queue, event.time_ns + clear_ns, EVENT_CLEAR, event.vehicle, 0);
+            plan_stop_line(engine, road, lane, event.time_ns);
+        } else if (event.type == EVENT_CLEAR) {
+            const TraceArrival *arrival = &trace->arrivals[event.vehicle];
+            const EventVehicle *vehicle = &engine->vehicles[event.vehicle];
+            add_trip(&trip_stats, (double)(event.time_ns - vehicle->enter_ns) / SDL_NS_PER_SECOND,
+                     lanes[arrival->entry.road][arrival->entry.lane].exit_s - vehicle->spawn_s);
+            engine->in_system--;
+            admit_arrivals(engine, trace, event.time_ns);
+        }
+    }
+
+    // Everyone admitted waited from their arrival until they got in
+    for (long i = 0; i < trace->next; i++) {
+        Uint64 arrival_ns = trace->arrivals[i].arrival_ns;
+        *total_entry_wait_s += (double)(engine->vehicles[i].enter_ns - arrival_ns) / SDL_NS_PER_SECOND;
+    }
+
+    int in_system = engine->in_system;
+    *events = engine->events;
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) free(engine->lanes[road][lane].queue);
+    }
+    free(engine->queue.events);
+    free(engine->vehicles);
+    free(engine);
+    return in_system;
+}
+
+// Replays a trace with no window, as fast as the CPU allows, for duration_s
+// simulated seconds or, if that is 0, until every vehicle in the trace has
+// made it through. Prints a summary and returns the process exit code.
+int run_headless(const char *trace_path, double duration_s, bool event_engine) {
+    ArrivalTrace trace;
+    if (!load_arrival_trace(&trace, trace_path)) {
+        printf("Cannot read trace %s\n", trace_path);
+        return 1;
+    }
+    if (trace.timestamped) {
+        printf("Replaying %ld arrivals from %s at their recorded times\n", trace.count, trace_path);
+    } else {
+        printf("Replaying %ld arrivals from %s, %d ms apart (no timestamps)\n", trace.count, trace_path, TRACE_SPACING_MS);
+    }
+
+    init_traffic_light();
+    init_lanes();
+    if (!index_init(&vehicle_index, 2 * MAX_VEHICLES)) {
+        printf("Out of memory for the vehicle index\n");
+        free(trace.arrivals);
+        return 1;
+    }
+
+    Uint64 end_ns = duration_s > 0 ? (Uint64)(duration_s * SDL_NS_PER_SECOND) : UINT64_MAX;
+    double total_entry_wait_s = 0; // Time arrivals spent held back by --capacity
+    int on_road = 0;
+    long events = 0;
+    Uint64 start_ns = SDL_GetTicksNS();
+
+    if (event_engine) {
+        on_road = run_event_engine(&trace, end_ns, duration_s <= 0, &events, &total_entry_wait_s);
+    }
+    while (!event_engine && simulation.time_ns < end_ns) {
+        // Everyone due by now enters, in order, until the roads are full
+        while (trace.next < trace.count && trace.arrivals[trace.next].arrival_ns <= simulation.time_ns) {
+            const TraceArrival *arrival = &trace.arrivals[trace.next];
+            if (!spawn_vehicle(arrival->entry.road, arrival->entry.lane, arrival->entry.id, arrival->entry.producer)) {
+                break;
+            }
+            total_entry_wait_s += (double)(simulation.time_ns - arrival->arrival_ns) / SDL_NS_PER_SECOND;
+            trace.next++;
+        }
+        if (duration_s <= 0 && trace.next == trace.count && vehicle_count == 0) break;
+
+        simulation_step();
+        on_road = vehicle_count;
+    }
+
+    double wall_s = (double)(SDL_GetTicksNS() - start_ns) / SDL_NS_PER_SECOND;
+    double sim_s = (double)simulation.time_ns / SDL_NS_PER_SECOND;
+    printf("Simulated %.1f s in %ld %s, %.3f s wall time: %.0f simulated seconds per wall second\n",
+           sim_s, event_engine ? events : simulation.steps, event_engine ? "events" : "steps", wall_s,
+           wall_s > 0 ? sim_s / wall_s : 0);
+    printf("Arrivals: %ld entered, %ld left over at the end, %d vehicles still on the road\n",
+           trace.next, trace.count - trace.next, on_road);
+    if (trace.next > 0) {
+        printf("Mean wait to enter a full road: %.2f s\n", total_entry_wait_s / trace.next);
+    }
+    print_trip_stats(&trip_stats);
+    if (trace.skipped > 0) {
+        printf("Skipped %d corrupt or malformed records in the trace\n", trace.skipped);
+    }
+
+    clear_vehicles();
+    index_free(&vehicle_index);
+    free_lanes();
+    pool_destroy(&vehicle_pool);
+    free(trace.arrivals);
+    return 0;
+}
+
+// Network mode (--grid RxC): a grid of intersections like the one in the
+// window, joined by road links. Vehicles drive straight through: one that
+// reaches the center of an intersection carries on along the same road and
+// lane into the next intersection, and its trip ends when it leaves the
+// edge of the grid. New vehicles enter at the edges at GRID_ARRIVAL_RATE.
+//
+// Intersections are split into contiguous blocks, one per worker thread,
+// and the workers meet at a barrier after every step. A vehicle crossing
+// into a neighbour goes through that link's single-producer
+// single-consumer ring, tagged with the step it left in, and the neighbour
+// only takes it from the next step on. So results don't depend on how many
+// workers there are or how they are scheduled, as long as no link fills up.
+typedef struct {
+    Uint64 born_ns;  // When the trip started
+    float v;
+    float distance;  // Driven on this trip so far
+    int lane;
+    int step;        // Step it left the upstream intersection in
+} GridTransfer;
+
+typedef struct {
+    SDL_AtomicU32 head; // Next slot to fill, only advanced by the upstream worker
+    char pad0[60];
+    SDL_AtomicU32 tail; // Next slot to empty, only advanced by the downstream worker
+    char pad1[60];
+    GridTransfer slots[GRID_LINK_CAPACITY];
+} GridLink;
+
+// Upstream side. Returns false if the link is full.
+bool grid_link_push(GridLink *link, const GridTransfer *transfer) {
+    Uint32 head = SDL_GetAtomicU32(&link->head);
+    if (head - SDL_GetAtomicU32(&link->tail) == GRID_LINK_CAPACITY) return false;
+
+    link->slots[head & (GRID_LINK_CAPACITY - 1)] = *transfer;
+    SDL_SetAtomicU32(&link->head, head + 1); // Publishes the slot
+    return true;
+}
+
+// Downstream side. Returns the oldest transfer without taking it, or NULL if empty.
+const GridTransfer *grid_link_peek(GridLink *link) {
+    Uint32 tail = SDL_GetAtomicU32(&link->tail);
+    if (tail == SDL_GetAtomicU32(&link->head)) return NULL;
+    return &link->slots[tail & (GRID_LINK_CAPACITY - 1)];
+}
+
+void grid_link_advance(GridLink *link) {
+    SDL_SetAtomicU32(&link->tail, SDL_GetAtomicU32(&link->tail) + 1);
+}
+
+// Each intersection keeps its own lanes. A vehicle's born_s there is pushed
+// back by the distance it drove before, so the trip so far is s - born_s.
+typedef struct {
+    TrafficLight light;
+    LanePartition lanes[4][3];
+    GridLink out[4];  // Towards the next intersection along each road
+    Uint32 rng;       // Arrivals at the edge, seeded per intersection
+} Intersection;
+
+typedef struct {
+    Intersection *intersections; // Row-major
+    int rows;
+    int cols;
+    int workers;
+    int steps;
+    int light_interval;   // Steps between light updates, as in simulation_step()
+    SDL_AtomicInt start;  // 1 once every worker is running, -1 to give up
+    SDL_AtomicInt arrived; // Workers at the barrier
+    SDL_AtomicInt generation; // Bumped each time everyone has arrived
+} GridNetwork;
+
+typedef struct {
+    GridNetwork *network;
+    int first;        // Intersections [first, last) are this worker's
+    int last;
+    float *accel;     // Lane kernel scratch
+    int accel_capacity;
+    long entered;
+    TripStats trips;
+} GridWorker;
+
+// The intersection a road's traffic comes from or goes to, -1 past the edge
+int grid_neighbour(const GridNetwork *network, int index, int road, bool downstream) {
+    static const int row_step[4] = {1, 0, -1, 0}; // Direction of travel of each road
+    static const int col_step[4] = {0, -1, 0, 1};
+    int sign = downstream ? 1 : -1;
+    int row = index / network->cols + sign * row_step[road];
+    int col = index % network->cols + sign * col_step[road];
+    if (row < 0 || row >= network->rows || col < 0 || col >= network->cols) return -1;
+    return row * network->cols + col;
+}
+
+// Uniform in [0, 1)
+float grid_random(Uint32 *state) {
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (*state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Appends a vehicle that has already driven trip_distance. Returns false if out of memory.
+bool grid_lane_push(LanePartition *partition, float v, float trip_distance, Uint64 born_ns) {
+    if (!lane_push(partition, 0, v, born_ns)) return false;
+    partition->born_s[partition->count - 1] -= trip_distance;
+    return true;
+}
+
+void grid_step_intersection(GridWorker *worker, int index, int step) {
+    GridNetwork *network = worker->network;
+    Intersection *intersection = &network->intersections[index];
+    Uint64 now_ns = (Uint64)step * simulation.step_ns;
+
+    // Take in whoever left the neighbours before this step, or new
+    // arrivals at the edge of the grid
+    for (int road = 0; road < 4; road++) {
+        int upstream = grid_neighbour(network, index, road, false);
+        if (upstream >= 0) {
+            GridLink *link = &network->intersections[upstream].out[road];
+            const GridTransfer *transfer;
+            while ((transfer = grid_link_peek(link)) && transfer->step < step) {
+                LanePartition *lane = &intersection->lanes[road][transfer->lane];
+                if (!grid_lane_push(lane, transfer->v, transfer->distance, transfer->born_ns)) break;
+                grid_link_advance(link);
+            }
+        } else {
+            for (int lane = 0; lane < 3; lane++) {
+                if (grid_random(&intersection->rng) < GRID_ARRIVAL_RATE * simulation.step_seconds &&
+                    grid_lane_push(&intersection->lanes[road][lane], DESIRED_SPEED, 0, now_ns)) {
+                    worker->entered++;
+                }
+            }
+        }
+    }
+
+    if (step > 0 && step % network->light_interval == 0) plan_traffic_lights(&intersection->light);
+
+    for (int road = 0; road < 4; road++) {
+        bool red = !intersection->light.green[road];
+        int downstream = grid_neighbour(network, index, road, true);
+        for (int lane = 0; lane < 3; lane++) {
+            LanePartition *partition = &intersection->lanes[road][lane];
+            int head = partition->head;
+            intersection->light.vehicle_count[road][lane] +=
+                lane_step(partition, red, simulation.step_seconds, &worker->accel, &worker->accel_capacity);
+
+            // Through the center: on to the next intersection, or out of the grid
+            while (partition->head < partition->count && partition->s[partition->head] > partition->exit_s) {
+                int i = partition->head;
+                float distance = partition->s[i] - partition->born_s[i];
+                if (downstream < 0) {
+                    add_trip(&worker->trips, (double)(now_ns + simulation.step_ns - partition->born_ns[i]) / SDL_NS_PER_SECOND,
+                             distance);
+                } else {
+                    GridTransfer transfer = {partition->born_ns[i], partition->v[i], distance, lane, step};
+                    if (!grid_link_push(&intersection->out[road], &transfer)) break; // Full: wait at the center
+                }
+                partition->head++;
+            }
+            if (partition->head != head) lane_trim(partition);
+        }
+    }
+}
+
+void grid_barrier_wait(GridNetwork *network) {
+    int generation = SDL_GetAtomicInt(&network->generation);
+    if (SDL_AddAtomicInt(&network->arrived, 1) == network->workers - 1) {
+        SDL_SetAtomicInt(&network->arrived, 0);
+        SDL_AddAtomicInt(&network->generation, 1);
+        return;
+    }
+
+    // Steps are short, so spin; but yield eventually in case there are more workers than cores
+    for (int spins = 0; SDL_GetAtomicInt(&network->generation) == generation; spins++) {
+        if (spins < GRID_BARRIER_SPINS) {
+            SDL_CPUPauseInstruction();
+        } else {
+            SDL_Delay(0);
+        }
+    }
+}
+
+int grid_worker_main(void *data) {
+    GridWorker *worker = data;
+    GridNetwork *network = worker->network;
+    while (SDL_GetAtomicInt(&network->start) == 0) {
+        SDL_Delay(0);
+    }
+    if (SDL_GetAtomicInt(&network->start) < 0) return 0;
+
+    for (int step = 0; step < network->steps; step++) {
+        for (int index = worker->first; index < worker->last; index++) {
+            grid_step_intersection(worker, index, step);
+        }
+        grid_barrier_wait(network);
+    }
+    return 0;
+}
+
+// Simulates a rows x cols grid for duration_s on `workers` threads, the
+// calling thread being one of them, and prints how fast it went. *trips
+// receives the combined trip statistics. Returns the wall time in seconds,
+// or a negative number on failure.
+double run_grid(int rows, int cols, int workers, double duration_s, TripStats *trips) {
+    if (workers > rows * cols) workers = rows * cols;
+
+    GridNetwork network = {0};
+    network.rows = rows;
+    network.cols = cols;
+    network.workers = workers;
+    network.steps = (int)(duration_s * SDL_NS_PER_SECOND / simulation.step_ns);
+    network.light_interval = (int)(SDL_MS_TO_NS(2000) / simulation.step_ns) + 1;
+    network.intersections = calloc((size_t)rows * cols, sizeof(Intersection));
+    GridWorker *pool = calloc(workers, sizeof(GridWorker));
+    SDL_Thread *threads[MAX_GRID_WORKERS] = {0};
+    if (!network.intersections || !pool) {
+        printf("Out of memory for a %dx%d grid\n", rows, cols);
+        free(network.intersections);
+        free(pool);
+        return -1;
+    }
+    for (int i = 0; i < rows * cols; i++) {
+        network.intersections[i].rng = (Uint32)i * 2654435761u + 1;
+        for (int road = 0; road < 4; road++) {
+            for (int lane = 0; lane < 3; lane++) {
+                lane_init_like(&network.intersections[i].lanes[road][lane], road, lane);
+            }
+        }
+    }
 
-typedef struct {
-    int road;
-    int lane;
-    int id;
-    float x, y;
-    bool active;
-    bool waiting;
-} Vehicle;
+    Uint64 start_ns = SDL_GetTicksNS();
+    int started = 0;
+    for (int w = 0; w < workers; w++) {
+        pool[w].network = &network;
+        pool[w].first = (int)((long)rows * cols * w / workers);
+        pool[w].last = (int)((long)rows * cols * (w + 1) / workers);
+    }
+    for (int w = 1; w < workers; w++) {
+        threads[w] = SDL_CreateThread(grid_worker_main, "grid", &pool[w]);
+        if (!threads[w]) break;
+        started++;
+    }
+    if (started == workers - 1) {
+        SDL_SetAtomicInt(&network.start, 1);
+        grid_worker_main(&pool[0]);
+    } else {
+        printf("SDL_CreateThread failed: %s\n", SDL_GetError());
+        SDL_SetAtomicInt(&network.start, -1);
+    }
+    for (int w = 1; w <= started; w++) {
+        SDL_WaitThread(threads[w], NULL);
+    }
+    double wall_s = (double)(SDL_GetTicksNS() - start_ns) / SDL_NS_PER_SECOND;
+
+    long entered = 0, on_road = 0;
+    memset(trips, 0, sizeof(*trips));
+    for (int w = 0; w < workers; w++) {
+        entered += pool[w].entered;
+        trips->trips += pool[w].trips.trips;
+        trips->total_travel_s += pool[w].trips.total_travel_s;
+        trips->total_delay_s += pool[w].trips.total_delay_s;
+        if (pool[w].trips.max_delay_s > trips->max_delay_s) trips->max_delay_s = pool[w].trips.max_delay_s;
+        free(pool[w].accel);
+    }
+    for (int i = 0; i < rows * cols; i++) {
+        for (int road = 0; road < 4; road++) {
+            for (int lane = 0; lane < 3; lane++) {
+                LanePartition *partition = &network.intersections[i].lanes[road][lane];
+                on_road += partition->count - partition->head;
+                lane_free(partition);
+            }
+        }
+    }
+    free(network.intersections);
+    free(pool);
+    if (started != workers - 1) return -1;
 
+    double intersection_steps = (double)rows * cols * network.steps;
+    printf("%dx%d grid, %2d workers: %d steps in %.3f s wall, %.1f M intersection-steps/s, %ld vehicles entered, %ld on the roads at the end\n",
+           rows, cols, workers, network.steps, wall_s, intersection_steps / wall_s / 1e6, entered, on_road);
+    return wall_s;
+}
+
+// Parallel-in-time mode (--headless --parareal SLICES): splits a long run
+// into time slices and works on all of them at once with the Parareal
+// scheme. A cheap coarse propagator G guesses the state at the start of
+// every slice; the fine propagator F, which is the stepped engine, then
+// runs every slice from its guess on the worker threads, and the
+// difference between the two corrects the next round of guesses:
+//
+//   U[n+1] = G(U_new[n]) + F(U_old[n]) - G(U_old[n])
+//
+// Rounds continue until no slice boundary moves by more than
+// PARAREAL_TOLERANCE. The state is the vehicles on the roads, lined up
+// across states by their place in the trace, plus the lights and the next
+// arrival due. Whether a vehicle is on the road or a light is green can't
+// be corrected by arithmetic, so the new coarse guess decides those and only
+// positions, speeds and entry times are corrected. A slice that starts from
+// exactly the same state as in the last round takes its fine result as it
+// is, and isn't run again, so slice n is exact after n rounds at the latest.
+//
+// Each slice state keeps its own lanes, a vehicle's handle there being its
+// index into the trace.
 typedef struct {
-    bool green[4]; // One for each road
-    int vehicle_count[4][3]; // Count per road and lane
-} TrafficLight;
+    LanePartition lanes[4][3];
+    TrafficLight light; // vehicle_count is kept up to date as in update_vehicles()
+    Uint64 last_light_update_ns;
+    long next_arrival;  // First trace arrival not on the roads yet
+    int in_system;
+    int step;           // Fine steps since the start of the run
+} SliceState;
 
-Vehicle vehicles[MAX_VEHICLES];
-int vehicle_count = 0;
-TrafficLight traffic_light;
-int last_processed_id = 0;
+typedef struct {
+    const ArrivalTrace *trace;
+    SliceState *start;    // Boundary states, start[n] being where slice n begins
+    SliceState *fine;     // F(start[n])
+    TripStats *trips;     // Completed during each slice's fine run
+    bool *stale;          // start[n] changed since fine[n] was run from it
+    int slice_steps;
+    int total_steps;
+    int light_interval;   // Steps between light updates, as lights_due() spaces them
+    SDL_AtomicInt next;   // Next slice to hand out this round
+    int last;
+} Parareal;
 
-void init_traffic_light() {
-    for (int i = 0; i < 4; i++) {
-        traffic_light.green[i] = false;
-        for (int j = 0; j < 3; j++) {
-            traffic_light.vehicle_count[i][j] = 0;
+// An empty state at the start of the run
+void slice_init(SliceState *state) {
+    memset(state, 0, sizeof(*state));
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            lane_init_like(&state->lanes[road][lane], road, lane);
         }
     }
 }
 
-void count_vehicles_per_lane() {
-    // Reset counts
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 3; j++) {
-            traffic_light.vehicle_count[i][j] = 0;
+// Returns false if out of memory
+bool slice_copy(SliceState *dst, const SliceState *src) {
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            const LanePartition *from = &src->lanes[road][lane];
+            LanePartition *to = &dst->lanes[road][lane];
+            int live = from->count - from->head;
+            if (live > to->capacity && !lane_resize(to, live)) return false;
+            if (live > 0) {
+                memcpy(to->s, from->s + from->head, live * sizeof(float));
+                memcpy(to->v, from->v + from->head, live * sizeof(float));
+                memcpy(to->waiting, from->waiting + from->head, live * sizeof(uint8_t));
+                memcpy(to->born_ns, from->born_ns + from->head, live * sizeof(Uint64));
+                memcpy(to->born_s, from->born_s + from->head, live * sizeof(float));
+                memcpy(to->handle, from->handle + from->head, live * sizeof(VehicleHandle));
+            }
+            to->head = 0;
+            to->count = live;
         }
     }
+    dst->light = src->light;
+    dst->last_light_update_ns = src->last_light_update_ns;
+    dst->next_arrival = src->next_arrival;
+    dst->in_system = src->in_system;
+    dst->step = src->step;
+    return true;
+}
 
-    // Count waiting vehicles
-    for (int i = 0; i < vehicle_count; i++) {
-        if (vehicles[i].active && vehicles[i].waiting) {
-            traffic_light.vehicle_count[vehicles[i].road][vehicles[i].lane]++;
+void slice_free(SliceState *state) {
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            lane_free(&state->lanes[road][lane]);
         }
     }
+    memset(state, 0, sizeof(*state));
 }
 
-void update_traffic_lights() {
-    count_vehicles_per_lane();
+// Marks who the light holds from scratch, for a state that was moved or
+// corrected outside lane_step(). Returns how many that is.
+int slice_mark_held(LanePartition *partition, bool red) {
+    int held = 0;
+    for (int i = partition->head; i < partition->count; i++) {
+        partition->waiting[i] = red & (partition->s[i] < partition->stop_s);
+        held += partition->waiting[i];
+    }
+    return held;
+}
 
-    // Reset all lights
-    for (int i = 0; i < 4; i++) {
-        traffic_light.green[i] = false;
+// Lets in everyone from the trace who is due by until_ns, while there is room
+void slice_admit(SliceState *state, const ArrivalTrace *trace, Uint64 until_ns) {
+    Uint64 now_ns = (Uint64)state->step * simulation.step_ns;
+    while (state->next_arrival < trace->count && (vehicle_capacity <= 0 || state->in_system < vehicle_capacity)) {
+        const TraceArrival *arrival = &trace->arrivals[state->next_arrival];
+        if (arrival->arrival_ns > until_ns) break;
+
+        // The first step at or after its arrival, unless it had to wait for room
+        Uint64 due_ns = (arrival->arrival_ns + simulation.step_ns - 1) / simulation.step_ns * simulation.step_ns;
+        LanePartition *partition = &state->lanes[arrival->entry.road][arrival->entry.lane];
+        if (!lane_push(partition, (VehicleHandle)state->next_arrival, DESIRED_SPEED, SDL_max(now_ns, due_ns))) break;
+        state->in_system++;
+        state->next_arrival++;
     }
+}
 
-    // Check lane 2 (index 2) priority for each road
-    int priority_road = -1;
-    int max_lane2_count = 0;
+// F: the stepped engine for `steps` steps from wherever the state is. It
+// admits arrivals as run_headless() does and moves the lanes with the same
+// lane_push(), lane_step() and lights_due() as simulation_step(), so a
+// serial run matches --headless without --parareal. Trips that end are
+// added to *trips.
+void fine_propagate(SliceState *state, const ArrivalTrace *trace, int steps,
+                    TripStats *trips, float **accel, int *accel_capacity) {
+    for (int end = state->step + steps; state->step < end; state->step++) {
+        Uint64 now_ns = (Uint64)state->step * simulation.step_ns;
+        slice_admit(state, trace, now_ns);
+        if (lights_due(now_ns, state->last_light_update_ns)) {
+            plan_traffic_lights(&state->light);
+            state->last_light_update_ns = now_ns;
+        }
 
-    for (int road = 0; road < 4; road++) {
-        if (traffic_light.vehicle_count[road][2] >= PRIORITY_THRESHOLD) {
-            if (traffic_light.vehicle_count[road][2] > max_lane2_count) {
-                max_lane2_count = traffic_light.vehicle_count[road][2];
-                priority_road = road;
+        for (int road = 0; road < 4; road++) {
+            bool red = !state->light.green[road];
+            for (int lane = 0; lane < 3; lane++) {
+                LanePartition *partition = &state->lanes[road][lane];
+                int head = partition->head;
+                state->light.vehicle_count[road][lane] +=
+                    lane_step(partition, red, simulation.step_seconds, accel, accel_capacity);
+
+                while (partition->head < partition->count && partition->s[partition->head] > partition->exit_s) {
+                    int i = partition->head++;
+                    add_trip(trips, (double)(now_ns + simulation.step_ns - partition->born_ns[i]) / SDL_NS_PER_SECOND,
+                             partition->exit_s - partition->born_s[i]);
+                    state->in_system--;
+                }
+                if (partition->head != head) lane_trim(partition);
             }
         }
     }
+}
 
-    // If a road has priority lane threshold, give it green
-    if (priority_road >= 0) {
-        traffic_light.green[priority_road] = true;
-    } else {
-        // Otherwise, find road with most waiting vehicles
-        int max_total = 0;
-        int busiest_road = -1;
+// G: a queue-only model in PARAREAL_COARSE_MS steps. Vehicles cruise at
+// DESIRED_SPEED until they reach a red light or the back of the queue
+// ahead, and stop there without braking or pulling away. The lights change
+// on the same steps as in the fine run, judged on who is held at the time.
+void coarse_propagate(SliceState *state, const ArrivalTrace *trace, int steps, int light_interval) {
+    int coarse_steps = SDL_max(1, (int)(SDL_MS_TO_NS(PARAREAL_COARSE_MS) / simulation.step_ns));
+    for (int end = state->step + steps; state->step < end;) {
+        int chunk = SDL_min(coarse_steps, end - state->step);
+        int light_step = (int)(state->last_light_update_ns / simulation.step_ns) + light_interval;
+        if (light_step == state->step) {
+            for (int road = 0; road < 4; road++) {
+                for (int lane = 0; lane < 3; lane++) {
+                    state->light.vehicle_count[road][lane] = slice_mark_held(&state->lanes[road][lane], !state->light.green[road]);
+                }
+            }
+            plan_traffic_lights(&state->light);
+            state->last_light_update_ns = (Uint64)state->step * simulation.step_ns;
+        } else {
+            chunk = SDL_min(chunk, light_step - state->step);
+        }
 
+        slice_admit(state, trace, (Uint64)(state->step + chunk - 1) * simulation.step_ns);
+        float dt = chunk * simulation.step_seconds;
         for (int road = 0; road < 4; road++) {
-            int total = 0;
+            bool red = !state->light.green[road];
             for (int lane = 0; lane < 3; lane++) {
-                total += traffic_light.vehicle_count[road][lane];
+                LanePartition *partition = &state->lanes[road][lane];
+                for (int i = partition->head; i < partition->count; i++) {
+                    float s = partition->s[i];
+                    float target = s + DESIRED_SPEED * dt;
+                    if (red && s < partition->stop_s) target = SDL_min(target, SDL_max(s, partition->stop_s - MIN_GAP));
+                    if (i > partition->head) {
+                        target = SDL_min(target, SDL_max(s, partition->s[i - 1] - VEHICLE_SIZE - MIN_GAP));
+                    }
+                    partition->s[i] = target;
+                    partition->v[i] = (target - s) / dt;
+                }
+                while (partition->head < partition->count && partition->s[partition->head] > partition->exit_s) {
+                    // Held when the lights last changed, as lane_pop() accounts for it
+                    state->light.vehicle_count[road][lane] -= partition->waiting[partition->head];
+                    partition->head++;
+                    state->in_system--;
+                }
             }
-            if (total > max_total) {
-                max_total = total;
-                busiest_road = road;
+        }
+        state->step += chunk;
+    }
+}
+
+// *out = a + b - c: a decides who is on the road and the lights, and the
+// vehicles b and c also have are corrected by how far b is from c. The
+// waiting counts are then taken from the corrected positions.
+// Returns false if out of memory.
+bool parareal_correct(SliceState *out, const SliceState *a, const SliceState *b, const SliceState *c) {
+    if (!slice_copy(out, a)) return false;
+
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            LanePartition *to = &out->lanes[road][lane];
+            const LanePartition *fine = &b->lanes[road][lane];
+            const LanePartition *coarse = &c->lanes[road][lane];
+            int j = fine->head, k = coarse->head;
+            for (int i = to->head; i < to->count; i++) {
+                VehicleHandle vehicle = to->handle[i];
+                while (j < fine->count && fine->handle[j] < vehicle) j++;
+                while (k < coarse->count && coarse->handle[k] < vehicle) k++;
+                if (j < fine->count && k < coarse->count && fine->handle[j] == vehicle && coarse->handle[k] == vehicle) {
+                    to->s[i] += fine->s[j] - coarse->s[k];
+                    to->v[i] += fine->v[j] - coarse->v[k];
+                    to->born_ns[i] += fine->born_ns[j] - coarse->born_ns[k];
+                    to->born_s[i] += fine->born_s[j] - coarse->born_s[k];
+                }
+
+                // Keep the corrected queue physical
+                if (to->v[i] < 0) to->v[i] = 0;
+                if (i > to->head && to->s[i] > to->s[i - 1] - VEHICLE_SIZE) to->s[i] = to->s[i - 1] - VEHICLE_SIZE;
             }
+            out->light.vehicle_count[road][lane] = slice_mark_held(to, !out->light.green[road]);
         }
+    }
+    return true;
+}
 
-        if (busiest_road >= 0) {
-            traffic_light.green[busiest_road] = true;
+// How far apart two versions of the same boundary are: the largest change
+// in a position or speed, or INFINITY if anything else differs. Waiting
+// counts are left out since they follow from the positions.
+float slice_distance(const SliceState *a, const SliceState *b) {
+    if (a->next_arrival != b->next_arrival || a->in_system != b->in_system ||
+        memcmp(a->light.green, b->light.green, sizeof(a->light.green)) != 0) {
+        return INFINITY;
+    }
+
+    float distance = 0;
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            const LanePartition *x = &a->lanes[road][lane];
+            const LanePartition *y = &b->lanes[road][lane];
+            if (x->count - x->head != y->count - y->head) return INFINITY;
+            for (int i = x->head, j = y->head; i < x->count; i++, j++) {
+                if (x->handle[i] != y->handle[j] || x->born_ns[i] != y->born_ns[j]) return INFINITY;
+                distance = SDL_max(distance, fabsf(x->s[i] - y->s[j]));
+                distance = SDL_max(distance, fabsf(x->v[i] - y->v[j]));
+                distance = SDL_max(distance, fabsf(x->born_s[i] - y->born_s[j]));
+            }
         }
     }
+    return distance;
 }
 
-void load_vehicles() {
-    FILE *fp = fopen("vehicle.data", "r");
-    if (!fp) return;
+int parareal_worker_main(void *data) {
+    Parareal *run = data;
+    float *accel = NULL;
+    int accel_capacity = 0;
 
-    int road, lane, id;
-    while (fscanf(fp, "%d %d %d", &road, &lane, &id) == 3) {
-        // Only process new vehicles
-        if (id <= last_processed_id) continue;
-        
-        // Check if vehicle already exists
-        bool exists = false;
-        for (int i = 0; i < vehicle_count; i++) {
-            if (vehicles[i].id == id) {
-                exists = true;
-                break;
+    for (int n; (n = SDL_AddAtomicInt(&run->next, 1)) < run->last;) {
+        if (!run->stale[n]) continue;
+        run->stale[n] = false;
+        memset(&run->trips[n], 0, sizeof(TripStats));
+        int steps = SDL_min(run->slice_steps, run->total_steps - run->start[n].step);
+        if (!slice_copy(&run->fine[n], &run->start[n])) continue; // Out of memory: the slice stays as it was
+        fine_propagate(&run->fine[n], run->trace, steps, &run->trips[n], &accel, &accel_capacity);
+    }
+    free(accel);
+    return 0;
+}
+
+// Runs the fine propagator on the stale slices in [first, slices) on
+// `workers` threads, the calling thread being one of them
+void parareal_fine_round(Parareal *run, int first, int slices, int workers) {
+    SDL_Thread *threads[MAX_GRID_WORKERS] = {0};
+    SDL_SetAtomicInt(&run->next, first);
+    run->last = slices;
+    for (int w = 1; w < workers && w < slices - first; w++) {
+        threads[w] = SDL_CreateThread(parareal_worker_main, "parareal", run);
+    }
+    parareal_worker_main(run); // Picks up the slices of any thread that failed to start
+    for (int w = 1; w < workers; w++) {
+        if (threads[w]) SDL_WaitThread(threads[w], NULL);
+    }
+}
+
+// Replays a trace for duration_s simulated seconds (or until PARAREAL_DRAIN_S
+// after the last arrival) twice: once with the fine propagator alone and
+// once in parallel in time with Parareal, and compares the two. Returns the
+// process exit code.
+int run_parareal(const char *trace_path, double duration_s, int slices, int workers) {
+    ArrivalTrace trace;
+    if (!load_arrival_trace(&trace, trace_path) || trace.count == 0) {
+        printf("Cannot read trace %s\n", trace_path);
+        return 1;
+    }
+    init_lanes();
+
+    Uint64 end_ns = duration_s > 0 ? (Uint64)(duration_s * SDL_NS_PER_SECOND)
+                                   : trace.arrivals[trace.count - 1].arrival_ns + SDL_MS_TO_NS(PARAREAL_DRAIN_S * 1000);
+    Parareal run = {0};
+    run.trace = &trace;
+    run.total_steps = (int)(end_ns / simulation.step_ns);
+    run.light_interval = (int)(SDL_MS_TO_NS(2000) / simulation.step_ns) + 1;
+    slices = SDL_clamp(slices, 1, SDL_max(run.total_steps, 1));
+    run.slice_steps = (run.total_steps + slices - 1) / slices;
+    slices = (run.total_steps + run.slice_steps - 1) / run.slice_steps;
+    printf("Replaying %ld arrivals from %s for %.1f simulated seconds\n", trace.count, trace_path,
+           (double)run.total_steps * simulation.step_seconds);
+
+    // Reference: the whole run on one thread
+    SliceState serial;
+    slice_init(&serial);
+    TripStats serial_trips = {0};
+    float *accel = NULL;
+    int accel_capacity = 0;
+    Uint64 start_ns = SDL_GetTicksNS();
+    fine_propagate(&serial, &trace, run.total_steps, &serial_trips, &accel, &accel_capacity);
+    double serial_s = (double)(SDL_GetTicksNS() - start_ns) / SDL_NS_PER_SECOND;
+    free(accel);
+    printf("Serial fine run: %.3f s wall\n", serial_s);
+    print_trip_stats(&serial_trips);
+
+    run.start = calloc(slices + 1, sizeof(SliceState));
+    run.fine = calloc(slices, sizeof(SliceState));
+    run.trips = calloc(slices, sizeof(TripStats));
+    run.stale = calloc(slices + 1, sizeof(bool));
+    SliceState *coarse = calloc(slices + 1, sizeof(SliceState)); // coarse[n + 1] = G(start[n]) as of the last round
+    if (!run.start || !run.fine || !run.trips || !run.stale || !coarse) {
+        printf("Out of memory for %d slices\n", slices);
+        free(run.start);
+        free(run.fine);
+        free(run.trips);
+        free(run.stale);
+        free(coarse);
+        slice_free(&serial);
+        free(trace.arrivals);
+        return 1;
+    }
+    for (int n = 0; n <= slices; n++) {
+        slice_init(&run.start[n]);
+        slice_init(&coarse[n]);
+        if (n < slices) slice_init(&run.fine[n]);
+    }
+    SliceState next, guess;
+    slice_init(&next);
+    slice_init(&guess);
+    bool ok = true;
+
+    start_ns = SDL_GetTicksNS();
+    for (int n = 0; n < slices && ok; n++) {
+        ok = slice_copy(&coarse[n + 1], &run.start[n]);
+        coarse_propagate(&coarse[n + 1], &trace, SDL_min(run.slice_steps, run.total_steps - run.start[n].step),
+                         run.light_interval);
+        ok = ok && slice_copy(&run.start[n + 1], &coarse[n + 1]);
+        run.stale[n] = true;
+    }
+
+    int rounds = 0;
+    float change = INFINITY;
+    for (int first = 0; first < slices && ok && change > PARAREAL_TOLERANCE; first++) {
+        parareal_fine_round(&run, first, slices, workers);
+        rounds++;
+
+        // Slice `first` started from its final state, so its end is final too
+        bool same_start = true;
+        change = 0;
+        for (int n = first; n < slices && ok; n++) {
+            if (same_start) {
+                ok = slice_copy(&next, &run.fine[n]);
+            } else {
+                ok = slice_copy(&guess, &run.start[n]);
+                coarse_propagate(&guess, &trace, SDL_min(run.slice_steps, run.total_steps - guess.step), run.light_interval);
+                ok = ok && parareal_correct(&next, &guess, &run.fine[n], &coarse[n + 1]);
+                SliceState swap = coarse[n + 1];
+                coarse[n + 1] = guess;
+                guess = swap;
             }
+
+            float moved = slice_distance(&next, &run.start[n + 1]);
+            same_start = moved == 0 && memcmp(&next.light, &run.start[n + 1].light, sizeof(TrafficLight)) == 0;
+            run.stale[n + 1] = !same_start;
+            change = SDL_max(change, moved);
+            SliceState swap = run.start[n + 1];
+            run.start[n + 1] = next;
+            next = swap;
+        }
+    }
+    double parareal_s = (double)(SDL_GetTicksNS() - start_ns) / SDL_NS_PER_SECOND;
+
+    TripStats trips = {0};
+    for (int n = 0; n < slices; n++) {
+        trips.trips += run.trips[n].trips;
+        trips.total_travel_s += run.trips[n].total_travel_s;
+        trips.total_delay_s += run.trips[n].total_delay_s;
+        if (run.trips[n].max_delay_s > trips.max_delay_s) trips.max_delay_s = run.trips[n].max_delay_s;
+    }
+    if (ok) {
+        printf("Parareal, %d slices on %d workers: converged after %d of at most %d rounds, %.3f s wall, "
+               "speedup %.2fx over the serial fine run\n",
+               slices, workers, rounds, slices, parareal_s, parareal_s > 0 ? serial_s / parareal_s : 0);
+        print_trip_stats(&trips);
+        printf("Final state differs from the serial run by %g px\n", slice_distance(&run.start[slices], &serial));
+        if (rounds == slices) {
+            printf("No parallel gain: it took one round per slice, so the slices ran one after another. "
+                   "The coarse model can't predict this traffic; use fewer slices or run without --parareal.\n");
+        }
+        if (workers > SDL_GetNumLogicalCPUCores()) {
+            printf("Note: this machine has %d cores, so the workers share them\n", SDL_GetNumLogicalCPUCores());
         }
+    } else {
+        printf("Out of memory during the Parareal run\n");
+    }
+
+    for (int n = 0; n <= slices; n++) {
+        slice_free(&run.start[n]);
+        slice_free(&coarse[n]);
+        if (n < slices) slice_free(&run.fine[n]);
+    }
+    slice_free(&next);
+    slice_free(&guess);
+    slice_free(&serial);
+    free(run.start);
+    free(run.fine);
+    free(run.trips);
+    free(run.stale);
+    free(coarse);
+    if (trace.skipped > 0) {
+        printf("Skipped %d corrupt or malformed records in the trace\n", trace.skipped);
+    }
+    free(trace.arrivals);
+    return ok ? 0 : 1;
+}
 
-        if (!exists && vehicle_count < MAX_VEHICLES) {
-            vehicles[vehicle_count].road = road;
-            vehicles[vehicle_count].lane = lane;
-            vehicles[vehicle_count].id = id;
-            vehicles[vehicle_count].active = true;
-            vehicles[vehicle_count].waiting = false;
+// Ingest against a full index: every record is looked up among 100k live
+// vehicles, as a log re-read does, then new vehicles are inserted while the
+// oldest leave so the live count holds steady.
+void benchmark_vehicle_index() {
+    VehicleIndex index;
+    uint64_t *scan = malloc(BENCH_LIVE_IDS * sizeof(uint64_t));
+    if (!scan || !index_init(&index, 2 * BENCH_LIVE_IDS)) {
+        printf("Out of memory for the index benchmark\n");
+        free(scan);
+        return;
+    }
+    for (int id = 1; id <= BENCH_LIVE_IDS; id++) {
+        index_put(&index, vehicle_key(0, id), (VehicleHandle)id);
+        scan[id - 1] = vehicle_key(0, id);
+    }
 
-            // Set initial position based on road and lane
-            float center_x = WINDOW_WIDTH / 2;
-            float center_y = WINDOW_HEIGHT / 2;
+    printf("Vehicle index, %d live vehicles:\n", BENCH_LIVE_IDS);
+    uint32_t seed = 1;
+    int found = 0;
+    Uint64 start = SDL_GetTicksNS();
+    for (int i = 0; i < BENCH_RECORDS; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        found += index_find(&index, vehicle_key(0, 1 + (int)(seed % BENCH_LIVE_IDS))) >= 0;
+    }
+    double ns = (double)(SDL_GetTicksNS() - start) / BENCH_RECORDS;
+    printf("%8d lookups: %.2f ns per record (%d found)\n", BENCH_RECORDS, ns, found);
 
-            switch (road) {
-                case 0: // North (top)
-                    vehicles[vehicle_count].x = center_x - ROAD_WIDTH/2 + LANE_WIDTH/2 + lane * LANE_WIDTH;
-                    vehicles[vehicle_count].y = 0;
-                    break;
-                case 1: // East (right)
-                    vehicles[vehicle_count].x = WINDOW_WIDTH;
-                    vehicles[vehicle_count].y = center_y - ROAD_WIDTH/2 + LANE_WIDTH/2 + lane * LANE_WIDTH;
-                    break;
-                case 2: // South (bottom)
-                    vehicles[vehicle_count].x = center_x + ROAD_WIDTH/2 - LANE_WIDTH/2 - lane * LANE_WIDTH;
-                    vehicles[vehicle_count].y = WINDOW_HEIGHT;
-                    break;
-                case 3: // West (left)
-                    vehicles[vehicle_count].x = 0;
-                    vehicles[vehicle_count].y = center_y + ROAD_WIDTH/2 - LANE_WIDTH/2 - lane * LANE_WIDTH;
-                    break;
+    start = SDL_GetTicksNS();
+    for (int i = 0; i < BENCH_RECORDS; i++) {
+        int id = BENCH_LIVE_IDS + 1 + i;
+        if (!index_put(&index, vehicle_key(0, id), (VehicleHandle)id)) break;
+        index_remove(&index, vehicle_key(0, id - BENCH_LIVE_IDS));
+    }
+    ns = (double)(SDL_GetTicksNS() - start) / BENCH_RECORDS;
+    printf("%8d inserts: %.2f ns per record (%d live after)\n", BENCH_RECORDS, ns, index.count);
+
+    // What each record cost when the duplicate check scanned every live vehicle
+    found = 0;
+    start = SDL_GetTicksNS();
+    for (int i = 0; i < BENCH_SCAN_RECORDS; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        uint64_t key = vehicle_key(0, 1 + (int)(seed % BENCH_LIVE_IDS));
+        for (int v = 0; v < BENCH_LIVE_IDS; v++) {
+            if (scan[v] == key) {
+                found++;
+                break;
             }
-            
-            last_processed_id = id;
-            vehicle_count++;
         }
     }
-    fclose(fp);
+    ns = (double)(SDL_GetTicksNS() - start) / BENCH_SCAN_RECORDS;
+    printf("%8d linear scans: %.2f ns per record (%d found)\n", BENCH_SCAN_RECORDS, ns, found);
+
+    index_free(&index);
+    free(scan);
+}
 
-    // Remove inactive vehicles to free up space
-    int write_index = 0;
-    for (int read_index = 0; read_index < vehicle_count; read_index++) {
-        if (vehicles[read_index].active) {
-            if (write_index != read_index) {
-                vehicles[write_index] = vehicles[read_index];
+// Times update_vehicles() on synthetic traffic of growing size, with half the
+// roads green, once per lane kernel the CPU supports. Run with --bench.
+void benchmark_vehicle_store() {
+    int sizes[] = {10000, 100000, 1000000};
+    const LaneKernel *selected = lane_kernel;
+    traffic_light.green[0] = traffic_light.green[2] = true;
+
+    for (int n = 0; n < LANE_KERNEL_COUNT * 3; n++) {
+        int k = n % 3;
+        lane_kernel = &lane_kernels[n / 3];
+        if (!lane_kernel_supported(lane_kernel)) continue;
+        if (k == 0) printf("%s kernel:\n", lane_kernel->name);
+
+        init_lanes();
+        int per_lane = sizes[k] / 12;
+        for (int road = 0; road < 4; road++) {
+            for (int lane = 0; lane < 3; lane++) {
+                // Each lane starts as one long queue reaching back off-screen
+                for (int i = 0; i < per_lane; i++) {
+                    if (!spawn_vehicle(road, lane, i + 1, road * 3 + lane)) break;
+                }
             }
-            write_index++;
         }
+
+        int vehicles = vehicle_count;
+        Uint64 start = SDL_GetTicksNS();
+        for (int tick = 0; tick < BENCH_TICKS; tick++) {
+            update_vehicles(0.001f);
+        }
+        double ns = (double)(SDL_GetTicksNS() - start) / BENCH_TICKS;
+        printf("%8d vehicles: %8.3f ms per tick, %.2f ns per vehicle\n", vehicles, ns / 1e6, ns / vehicles);
+
+        clear_vehicles();
+        free_lanes();
     }
-    vehicle_count = write_index;
+    lane_kernel = selected;
+    init_traffic_light();
+
+    benchmark_vehicle_index();
 }
 
-void update_vehicles(float delta_time) {
-    float speed = 100.0f * delta_time;
-    float center_x = WINDOW_WIDTH / 2;
-    float center_y = WINDOW_HEIGHT / 2;
-    float stop_distance = 180.0f; // Distance from center to stop
+// The simulation runs on its own thread and hands the renderer a snapshot
+// of what to draw after each batch of steps, through a triple buffer: the
+// simulation fills the back buffer and swaps it into the middle, and the
+// renderer swaps the middle out whenever a fresh one is there. Neither side
+// ever waits for the other, and the renderer never touches live state.
+typedef struct {
+    float x, y;           // Top-left corner at the latest step
+    float prev_x, prev_y; // At the step before, to draw in between
+} SnapshotVehicle;
+
+typedef struct {
+    SnapshotVehicle *vehicles[2]; // By color, as in vehicle_batches
+    int count[2];
+    int capacity[2];
+    TrafficLight light;
+    Uint64 step_ns;               // Real time (SDL_GetTicksNS()) the latest step stands for
+} Snapshot;
 
-    for (int i = 0; i < vehicle_count; i++) {
-        if (!vehicles[i].active) continue;
+Snapshot snapshots[3];
+SDL_AtomicInt snapshot_middle; // Index of the buffer between the two threads, plus SNAPSHOT_FRESH
+int snapshot_back = 1;         // Simulation side only
+int snapshot_front = 2;        // Render side only
 
-        float dx = vehicles[i].x - center_x;
-        float dy = vehicles[i].y - center_y;
-        float distance_to_center = sqrtf(dx * dx + dy * dy);
+// Copies what the renderer needs into the back buffer and swaps it into the middle
+void publish_snapshot(Uint64 step_ns) {
+    Snapshot *snapshot = &snapshots[snapshot_back];
+    snapshot->count[0] = snapshot->count[1] = 0;
+    for (int road = 0; road < 4; road++) {
+        for (int lane = 0; lane < 3; lane++) {
+            const LanePartition *partition = &lanes[road][lane];
+            int color = lane == 2;
+            for (int i = partition->head; i < partition->count; i++) {
+                if (partition->s[i] < -VEHICLE_SIZE/2) break; // The rest are queued off-screen
 
-        // Check if should stop at traffic light
-        bool should_stop = !traffic_light.green[vehicles[i].road] && distance_to_center > stop_distance;
+                if (snapshot->count[color] == snapshot->capacity[color]) {
+                    int capacity = snapshot->capacity[color] ? snapshot->capacity[color] * 2 : 256;
+                    SnapshotVehicle *vehicles = realloc(snapshot->vehicles[color], capacity * sizeof(SnapshotVehicle));
+                    if (!vehicles) break; // Out of memory: the rest of the lane isn't drawn this time
+                    snapshot->vehicles[color] = vehicles;
+                    snapshot->capacity[color] = capacity;
+                }
 
-        if (should_stop) {
-            vehicles[i].waiting = true;
-            continue;
-        } else {
-            vehicles[i].waiting = false;
+                SnapshotVehicle *vehicle = &snapshot->vehicles[color][snapshot->count[color]++];
+                vehicle->x = partition->origin_x + partition->dir_x * partition->s[i] - VEHICLE_SIZE/2;
+                vehicle->y = partition->origin_y + partition->dir_y * partition->s[i] - VEHICLE_SIZE/2;
+                vehicle->prev_x = partition->origin_x + partition->dir_x * partition->prev_s[i] - VEHICLE_SIZE/2;
+                vehicle->prev_y = partition->origin_y + partition->dir_y * partition->prev_s[i] - VEHICLE_SIZE/2;
+            }
         }
+    }
+    snapshot->light = traffic_light;
+    snapshot->step_ns = step_ns;
 
-        switch (vehicles[i].road) {
-            case 0: // North - move down
-                vehicles[i].y += speed;
-                if (vehicles[i].y > center_y - CENTER_SIZE/2) vehicles[i].active = false;
-                break;
-            case 1: // East - move left
-                vehicles[i].x -= speed;
-                if (vehicles[i].x < center_x + CENTER_SIZE/2) vehicles[i].active = false;
-                break;
-            case 2: // South - move up
-                vehicles[i].y -= speed;
-                if (vehicles[i].y < center_y + CENTER_SIZE/2) vehicles[i].active = false;
-                break;
-            case 3: // West - move right
-                vehicles[i].x += speed;
-                if (vehicles[i].x > center_x - CENTER_SIZE/2) vehicles[i].active = false;
-                break;
-        }
+    snapshot_back = SDL_SetAtomicInt(&snapshot_middle, snapshot_back | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+}
+
+// The newest snapshot published, which stays the renderer's until it calls this again
+const Snapshot *latest_snapshot() {
+    if (SDL_GetAtomicInt(&snapshot_middle) & SNAPSHOT_FRESH) {
+        snapshot_front = SDL_SetAtomicInt(&snapshot_middle, snapshot_front) & ~SNAPSHOT_FRESH;
+    }
+    return &snapshots[snapshot_front];
+}
+
+// Real-time pacing of the fixed steps, owned by whichever thread runs them
+typedef struct {
+    Uint64 last_ns;
+    Uint64 accumulator_ns; // Real time not simulated yet
+    Uint64 last_load_ns;
+    long dropped_steps;
+} SimClock;
+
+SDL_Thread *sim_thread = NULL;
+SDL_AtomicInt sim_running;
+
+// Brings in new vehicles, runs the steps real time is owed and publishes a
+// snapshot if anything moved. Returns how long until the next step is due.
+Uint64 advance_simulation(SimClock *clock) {
+    Uint64 now_ns = SDL_GetTicksNS();
+    Uint64 step_ns = simulation.step_ns;
+    clock->accumulator_ns += now_ns - clock->last_ns;
+    clock->last_ns = now_ns;
+
+    if (!ingest_thread && now_ns - clock->last_load_ns > SDL_MS_TO_NS(INGEST_POLL_MS)) {
+        // No worker: load vehicles from file every 0.5 seconds
+        Uint64 start = profile_begin();
+        read_vehicle_source();
+        profile_end(PHASE_INGEST, start);
+        clock->last_load_ns = now_ns;
+    }
+    Uint64 start = profile_begin();
+    spawn_pending_vehicles();
+    profile_end(PHASE_SPAWN, start);
+
+    // Catch up with real time. After a stall, simulating all of it would
+    // make the next batch slower still, so anything past MAX_SUBSTEPS
+    // steps is skipped instead.
+    Uint64 steps = clock->accumulator_ns / step_ns;
+    if (steps > MAX_SUBSTEPS) {
+        clock->dropped_steps += steps - MAX_SUBSTEPS;
+        steps = MAX_SUBSTEPS;
+        clock->accumulator_ns = MAX_SUBSTEPS * step_ns + clock->accumulator_ns % step_ns;
+    }
+    for (Uint64 step = 0; step < steps; step++) {
+        if (step == steps - 1) save_previous_positions();
+        simulation_step();
+    }
+    clock->accumulator_ns -= steps * step_ns;
+    if (steps > 0) {
+        start = profile_begin();
+        publish_snapshot(now_ns - clock->accumulator_ns);
+        profile_end(PHASE_SNAPSHOT, start);
+    }
+
+    return step_ns - clock->accumulator_ns;
+}
+
+int sim_thread_main(void *data) {
+    SimClock *clock = data;
+    while (SDL_GetAtomicInt(&sim_running)) {
+        SDL_DelayNS(advance_simulation(clock));
     }
+    return 0;
 }
 
-void draw_roads(SDL_Renderer *renderer) {
+// Returns the number of draw calls it made
+int draw_roads(SDL_Renderer *renderer) {
+    int calls = 0;
     float center_x = WINDOW_WIDTH / 2;
     float center_y = WINDOW_HEIGHT / 2;
 
@@ -224,10 +3163,12 @@ void draw_roads(SDL_Renderer *renderer) {
     // North-South road
     SDL_FRect ns_road = {center_x - ROAD_WIDTH/2, 0, ROAD_WIDTH, WINDOW_HEIGHT};
     SDL_RenderFillRect(renderer, &ns_road);
+    calls++;
 
     // East-West road
     SDL_FRect ew_road = {0, center_y - ROAD_WIDTH/2, WINDOW_WIDTH, ROAD_WIDTH};
     SDL_RenderFillRect(renderer, &ew_road);
+    calls++;
 
     // Draw lane markings (white dashed lines)
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
@@ -238,6 +3179,7 @@ void draw_roads(SDL_Renderer *renderer) {
         for (int y = 0; y < WINDOW_HEIGHT; y += 20) {
             SDL_FRect dash = {x - 1, y, 2, 10};
             SDL_RenderFillRect(renderer, &dash);
+            calls++;
         }
     }
 
@@ -247,6 +3189,7 @@ void draw_roads(SDL_Renderer *renderer) {
         for (int x = 0; x < WINDOW_WIDTH; x += 20) {
             SDL_FRect dash = {x, y - 1, 10, 2};
             SDL_RenderFillRect(renderer, &dash);
+            calls++;
         }
     }
 
@@ -254,9 +3197,48 @@ void draw_roads(SDL_Renderer *renderer) {
     SDL_SetRenderDrawColor(renderer, 40, 40, 40, 255);
     SDL_FRect center = {center_x - CENTER_SIZE/2, center_y - CENTER_SIZE/2, CENTER_SIZE, CENTER_SIZE};
     SDL_RenderFillRect(renderer, &center);
+    return calls + 1;
+}
+
+// The roads, lane markings and center never change, so they are drawn once
+// into a texture and copied to the screen with a single call each frame.
+// Set back to NULL to rebuild it, e.g. when the output size changes.
+SDL_Texture *background = NULL;
+bool cache_background = true; // Cleared by --no-background-cache, or if render targets aren't supported
+
+// Clears the screen to the grass and draws the roads over it.
+// Returns the number of draw calls it made.
+int draw_background(SDL_Renderer *renderer) {
+    if (!background && cache_background) {
+        int width, height;
+        SDL_GetCurrentRenderOutputSize(renderer, &width, &height);
+        background = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width, height);
+        if (!background || !SDL_SetRenderTarget(renderer, background)) {
+            printf("Cannot cache the background (%s), drawing it every frame\n", SDL_GetError());
+            SDL_DestroyTexture(background);
+            background = NULL;
+            cache_background = false;
+        } else {
+            // Drawn at the output's resolution, in window coordinates
+            SDL_SetRenderScale(renderer, (float)width / WINDOW_WIDTH, (float)height / WINDOW_HEIGHT);
+            SDL_SetRenderDrawColor(renderer, 34, 139, 34, 255); // Green background
+            SDL_RenderClear(renderer);
+            draw_roads(renderer);
+            SDL_SetRenderScale(renderer, 1, 1);
+            SDL_SetRenderTarget(renderer, NULL);
+        }
+    }
+
+    if (background) {
+        SDL_RenderTexture(renderer, background, NULL, NULL);
+        return 1;
+    }
+    SDL_SetRenderDrawColor(renderer, 34, 139, 34, 255);
+    SDL_RenderClear(renderer);
+    return 1 + draw_roads(renderer);
 }
 
-void draw_traffic_lights(SDL_Renderer *renderer) {
+void draw_traffic_lights(SDL_Renderer *renderer, const TrafficLight *light) {
     float center_x = WINDOW_WIDTH / 2;
     float center_y = WINDOW_HEIGHT / 2;
     float light_distance = 200.0f;
@@ -290,7 +3272,7 @@ void draw_traffic_lights(SDL_Renderer *renderer) {
         SDL_RenderFillRect(renderer, &light_bg);
 
         // Draw red or green light
-        if (traffic_light.green[road]) {
+        if (light->green[road]) {
             SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255); // Green
             SDL_FRect green_light = {x + 2, y + TRAFFIC_LIGHT_SIZE + 3, TRAFFIC_LIGHT_SIZE - 4, TRAFFIC_LIGHT_SIZE - 4};
             SDL_RenderFillRect(renderer, &green_light);
@@ -302,36 +3284,66 @@ void draw_traffic_lights(SDL_Renderer *renderer) {
     }
 }
 
-void draw_vehicles(SDL_Renderer *renderer) {
-    for (int i = 0; i < vehicle_count; i++) {
-        if (!vehicles[i].active) continue;
+// Vehicle rectangles of one color, drawn with one fill and one outline call
+typedef struct {
+    SDL_FRect *rects;
+    int count;
+    int capacity;
+    SDL_Color fill;
+    SDL_Color border;
+} RectBatch;
 
-        // Color based on lane (lane 2 is special - blue)
-        if (vehicles[i].lane == 2) {
-            SDL_SetRenderDrawColor(renderer, 100, 100, 255, 255); // Blue for lane 2
-        } else {
-            SDL_SetRenderDrawColor(renderer, 255, 100, 100, 255); // Red for other lanes
-        }
+RectBatch vehicle_batches[2] = {
+    {NULL, 0, 0, {255, 100, 100, 255}, {200, 50, 50, 255}}, // Red for lanes 0 and 1
+    {NULL, 0, 0, {100, 100, 255, 255}, {50, 50, 200, 255}}, // Blue for lane 2 (priority)
+};
+
+// Draws what the batch holds and empties it. Returns the number of draw calls it made.
+int flush_rect_batch(SDL_Renderer *renderer, RectBatch *batch) {
+    if (batch->count == 0) return 0;
+    SDL_SetRenderDrawColor(renderer, batch->fill.r, batch->fill.g, batch->fill.b, batch->fill.a);
+    SDL_RenderFillRects(renderer, batch->rects, batch->count);
+    SDL_SetRenderDrawColor(renderer, batch->border.r, batch->border.g, batch->border.b, batch->border.a);
+    SDL_RenderRects(renderer, batch->rects, batch->count);
+    batch->count = 0;
+    return 2;
+}
 
-        SDL_FRect vehicle_rect = {
-            vehicles[i].x - VEHICLE_SIZE/2,
-            vehicles[i].y - VEHICLE_SIZE/2,
-            VEHICLE_SIZE,
-            VEHICLE_SIZE
-        };
-        SDL_RenderFillRect(renderer, &vehicle_rect);
+// alpha is how far real time has got from the previous simulation step
+// towards the latest one, 0 to 1. Vehicles are gathered by color and drawn
+// a whole color at a time, so the number of draw calls doesn't grow with
+// the traffic. Returns the number of draw calls it made.
+int draw_vehicles(SDL_Renderer *renderer, const Snapshot *snapshot, float alpha) {
+    int calls = 0;
+    for (int color = 0; color < 2; color++) {
+        RectBatch *batch = &vehicle_batches[color];
+        for (int i = 0; i < snapshot->count[color]; i++) {
+            if (batch->count == batch->capacity) {
+                int capacity = batch->capacity ? batch->capacity * 2 : 256;
+                SDL_FRect *rects = realloc(batch->rects, capacity * sizeof(SDL_FRect));
+                if (rects) {
+                    batch->rects = rects;
+                    batch->capacity = capacity;
+                } else {
+                    calls += flush_rect_batch(renderer, batch); // Out of memory: draw what fits
+                    if (batch->capacity == 0) return calls;
+                }
+            }
 
-        // Draw vehicle border
-        if (vehicles[i].lane == 2) {
-            SDL_SetRenderDrawColor(renderer, 50, 50, 200, 255);
-        } else {
-            SDL_SetRenderDrawColor(renderer, 200, 50, 50, 255);
+            const SnapshotVehicle *vehicle = &snapshot->vehicles[color][i];
+            batch->rects[batch->count++] = (SDL_FRect){
+                vehicle->prev_x + (vehicle->x - vehicle->prev_x) * alpha,
+                vehicle->prev_y + (vehicle->y - vehicle->prev_y) * alpha,
+                VEHICLE_SIZE,
+                VEHICLE_SIZE
+            };
         }
-        SDL_RenderRect(renderer, &vehicle_rect);
+        calls += flush_rect_batch(renderer, batch);
     }
+    return calls;
 }
 
-void draw_info(SDL_Renderer *renderer) {
+void draw_info(SDL_Renderer *renderer, const TrafficLight *light) {
     float bar_x = 10;
     float bar_y = 10;
     float bar_width = 150;
@@ -347,7 +3359,7 @@ void draw_info(SDL_Renderer *renderer) {
         SDL_RenderFillRect(renderer, &bg);
 
         // Draw lane 2 vehicle count as a bar
-        int count = traffic_light.vehicle_count[road][2];
+        int count = light->vehicle_count[road][2];
         float fill_width = (count / (float)PRIORITY_THRESHOLD) * bar_width;
         if (fill_width > bar_width) fill_width = bar_width;
 
@@ -364,9 +3376,216 @@ void draw_info(SDL_Renderer *renderer) {
         SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
         SDL_RenderRect(renderer, &bg);
     }
+
+    // Admission backlog as a fraction of its capacity, below the lane bars
+    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 200);
+    SDL_FRect bg = {bar_x, bar_y + 4 * 25, bar_width, bar_height / 2};
+    SDL_RenderFillRect(renderer, &bg);
+
+    float backlog_width = SDL_GetAtomicInt(&backlog_depth) / (float)(2 * SPAWN_LIST_CAPACITY) * bar_width;
+    SDL_SetRenderDrawColor(renderer, 255, 165, 0, 255); // Orange
+    SDL_FRect fill = {bar_x, bar_y + 4 * 25, backlog_width, bar_height / 2};
+    SDL_RenderFillRect(renderer, &fill);
+
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderRect(renderer, &bg);
+}
+
+// p50 and p99 of every phase timed so far, in the top right corner
+void draw_profile_overlay(SDL_Renderer *renderer) {
+    float width = 36 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 12;
+    float x = WINDOW_WIDTH - width - 10;
+    float y = 10;
+    float line = SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 4;
+
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 200);
+    SDL_FRect bg = {x, y, width, (PHASE_COUNT + 1) * line + 8};
+    SDL_RenderFillRect(renderer, &bg);
+
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDebugText(renderer, x + 6, y + 6, "phase               p50 us    p99 us");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        long samples;
+        double p50 = profile_percentile(phase, 0.5, &samples);
+        double p99 = profile_percentile(phase, 0.99, &samples);
+        char text[64];
+        snprintf(text, sizeof(text), "%-16s %9.1f %9.1f", phase_names[phase], p50 / 1000, p99 / 1000);
+        SDL_RenderDebugText(renderer, x + 6, y + 6 + (phase + 1) * line, text);
+    }
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    bool watch_source = false; // Event-driven ingest on its own thread
+    bool benchmark = false;
+    bool reactive_lights = false; // Re-plan the lights as soon as a priority lane fills up
+    bool headless = false;
+    const char *trace_path = NULL;
+    double duration_s = 0; // Simulated seconds to run headless, 0 for the whole trace
+    bool event_engine = false; // Headless only: discrete events instead of fixed steps
+    int parareal_slices = 0; // Headless only: parallel in time with this many slices
+    int grid_rows = 0, grid_cols = 0; // Network mode when set
+    int grid_workers = 0; // 0 means one per core
+    bool grid_scaling = false;
+    bool check_kernels = false;
+    bool uncapped = false; // Frames as fast as possible, no vsync
+    int sim_hz = SIM_HZ;
+    const char *kernel_name = NULL; // NULL picks the fastest the CPU supports
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--shm") == 0) {
+            vehicle_ring = vehicle_ring_open();
+            if (!vehicle_ring) {
+                printf("Cannot open shared memory ring\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--text") == 0) {
+            use_text_log = true;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch_source = true;
+        } else if (strcmp(argv[i], "--archive") == 0) {
+            archive_segments = true;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchmark = true;
+        } else if (strcmp(argv[i], "--reactive") == 0) {
+            reactive_lights = true;
+        } else if (strcmp(argv[i], "--capacity") == 0 && i + 1 < argc) {
+            vehicle_capacity = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            kernel_name = argv[++i];
+        } else if (strcmp(argv[i], "--uncapped") == 0) {
+            uncapped = true;
+        } else if (strcmp(argv[i], "--no-background-cache") == 0) {
+            cache_background = false;
+        } else if (strcmp(argv[i], "--debug-checks") == 0) {
+            debug_checks = true;
+        } else if (strcmp(argv[i], "--check-kernels") == 0) {
+            check_kernels = true;
+        } else if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc) {
+            sim_hz = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            duration_s = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &grid_rows, &grid_cols) != 2 || grid_rows <= 0 || grid_cols <= 0) {
+                printf("--grid expects ROWSxCOLS, e.g. 100x100\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--parareal") == 0 && i + 1 < argc) {
+            parareal_slices = atoi(argv[++i]);
+            if (parareal_slices <= 0) {
+                printf("--parareal expects a number of time slices\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            grid_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--grid-scaling") == 0) {
+            grid_scaling = true;
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "event") == 0) {
+                event_engine = true;
+            } else if (strcmp(argv[i], "step") != 0) {
+                printf("Unknown engine '%s', expected step or event\n", argv[i]);
+                return 1;
+            }
+        }
+    }
+
+    if (sim_hz <= 0) {
+        printf("--hz must be a positive number of steps per second\n");
+        return 1;
+    }
+    if (event_engine && reactive_lights) {
+        // --reactive flips the lights from one step to the next under saturation,
+        // which the event engine doesn't model, so its statistics would be wrong
+        printf("--engine event does not support --reactive, use --engine step\n");
+        return 1;
+    }
+    simulation_init(sim_hz);
+    simulation.reactive_lights = reactive_lights;
+
+    if (!select_lane_kernel(kernel_name)) {
+        printf("Lane kernel '%s' is unknown or not supported by this CPU\n", kernel_name);
+        return 1;
+    }
+    if (check_kernels) {
+        bool ok = check_lane_kernels(KERNEL_CHECK_LANES, true);
+        printf("%s\n", ok ? "All lane kernels agree with the scalar kernel" : "Lane kernel check FAILED");
+        return ok ? 0 : 1;
+    }
+    if (debug_checks) {
+        printf("Using the %s lane kernel\n", lane_kernel->name);
+        if (!check_lane_kernels(100, false)) {
+            printf("Warning: SIMD lane kernels disagree with the scalar kernel, see --check-kernels\n");
+        }
+    }
+
+    if (benchmark) {
+        vehicle_capacity = 0;
+        if (!index_init(&vehicle_index, 2 * MAX_VEHICLES)) {
+            printf("Out of memory for the vehicle index\n");
+            return 1;
+        }
+        benchmark_vehicle_store();
+        index_free(&vehicle_index);
+        pool_destroy(&vehicle_pool);
+        return 0;
+    }
+
+    if (grid_rows > 0) {
+        init_lanes(); // Every intersection in the grid has the same geometry
+        int cores = SDL_GetNumLogicalCPUCores();
+        double seconds = duration_s > 0 ? duration_s : GRID_DEFAULT_SECONDS;
+        TripStats trips;
+        if (!grid_scaling) {
+            int workers = SDL_clamp(grid_workers > 0 ? grid_workers : cores, 1, MAX_GRID_WORKERS);
+            bool ok = run_grid(grid_rows, grid_cols, workers, seconds, &trips) >= 0;
+            print_trip_stats(&trips);
+            return ok ? 0 : 1;
+        }
+
+        // Doubling the workers each run, up to one per core (or --workers)
+        int max_workers = SDL_clamp(grid_workers > 0 ? grid_workers : cores, 1, MAX_GRID_WORKERS);
+        double base_s = 0;
+        TripStats first = {0};
+        for (int workers = 1;; workers *= 2) {
+            if (workers > max_workers) workers = max_workers;
+            double wall_s = run_grid(grid_rows, grid_cols, workers, seconds, &trips);
+            if (wall_s < 0) return 1;
+
+            if (workers == 1) {
+                base_s = wall_s;
+                first = trips;
+                print_trip_stats(&trips);
+            } else {
+                // Workers add up their own trips, so totals may differ in the last bits
+                bool same = trips.trips == first.trips && trips.max_delay_s == first.max_delay_s &&
+                            fabs(trips.total_delay_s - first.total_delay_s) <= 1e-9 * first.total_delay_s;
+                printf("    speedup %.2fx over 1 worker, efficiency %.0f%%%s\n", base_s / wall_s,
+                       100.0 * base_s / wall_s / workers, same ? "" : " (trips differ from 1 worker!)");
+            }
+            if (workers == max_workers) break;
+        }
+        if (max_workers > cores) {
+            printf("Note: this machine has %d cores, so runs with more workers share them\n", cores);
+        }
+        return 0;
+    }
+
+    if (headless) {
+        if (!trace_path) {
+            printf("--headless needs --trace FILE, a vehicle log to replay\n");
+            return 1;
+        }
+        if (parareal_slices > 0) {
+            int workers = SDL_clamp(grid_workers > 0 ? grid_workers : SDL_GetNumLogicalCPUCores(), 1, MAX_GRID_WORKERS);
+            return run_parareal(trace_path, duration_s, parareal_slices, workers);
+        }
+        return run_headless(trace_path, duration_s, event_engine);
+    }
+
     if (!SDL_Init(SDL_INIT_VIDEO)) {
         printf("SDL_Init failed: %s\n", SDL_GetError());
         return 1;
@@ -388,56 +3607,164 @@ int main() {
     }
 
     init_traffic_light();
+    init_lanes();
+    if (!index_init(&vehicle_index, 2 * MAX_VEHICLES)) {
+        printf("Out of memory for the vehicle index\n");
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return 1;
+    }
+    if (!vehicle_ring) init_segment_readers();
+
+    spawn_lock = SDL_CreateMutex();
+    ingest_wakeup = SDL_CreateSemaphore(0);
+
+    profiler_init(); // Before the ingest and simulation threads, which time their phases too
+
+    SourceWatch watch = {0};
+    if (watch_source && !open_source_watch(&watch)) {
+        printf("Event-driven ingest unavailable, falling back to polling\n");
+    }
+    SDL_SetAtomicInt(&ingest_running, 1);
+    ingest_thread = SDL_CreateThread(ingest_thread_main, "ingest", &watch);
+    if (!ingest_thread) {
+        printf("SDL_CreateThread failed: %s (reading vehicles on the render loop)\n", SDL_GetError());
+        close_source_watch(&watch);
+    }
 
     bool running = true;
     SDL_Event event;
-    Uint64 last_time = SDL_GetTicks();
-    Uint64 last_load_time = SDL_GetTicks();
-    Uint64 last_light_update = SDL_GetTicks();
+    Uint64 last_frame_ns = SDL_GetTicksNS();
+    FrameStats frame_stats = {0};
+    FrameStats render_stats = {0}; // CPU time spent issuing draw calls, up to the present
+    int background_calls = 0;
+    int vehicle_calls = 0;
+    bool show_profile = false; // Phase timings overlay, toggled with P
+
+    // The simulation advances in fixed steps of simulated time on its own
+    // thread, whatever the frame rate, so a run doesn't depend on how fast
+    // it is drawn and a slow frame doesn't hold it up
+    Uint64 step_ns = simulation.step_ns;
+    SimClock sim_clock = {last_frame_ns, 0, last_frame_ns, 0};
+    SDL_SetAtomicInt(&sim_running, 1);
+    sim_thread = SDL_CreateThread(sim_thread_main, "simulation", &sim_clock);
+    if (!sim_thread) {
+        printf("SDL_CreateThread failed: %s (simulating on the render loop)\n", SDL_GetError());
+    }
+
+    FramePacer pacer;
+    frame_pacer_init(&pacer, window, renderer, uncapped);
 
     printf("Traffic Simulator Started\n");
     printf("Lane 2 Priority Threshold: %d vehicles\n", PRIORITY_THRESHOLD);
     printf("Blue vehicles = Lane 2 (priority lane)\n");
-    printf("Red vehicles = Lanes 0 and 1\n\n");
+    printf("Red vehicles = Lanes 0 and 1\n");
+    printf("Press P to show or hide phase timings\n");
+    if (pacer.uncapped) {
+        printf("Frame rate uncapped\n\n");
+    } else {
+        printf("Frame rate capped at %.1f Hz (%s)\n\n", (double)SDL_NS_PER_SECOND / pacer.period_ns,
+               pacer.vsync ? "vsync" : "timed sleeps");
+    }
 
     while (running) {
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_EVENT_QUIT) {
                 running = false;
+            } else if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_P && !event.key.repeat) {
+                show_profile = !show_profile;
+            } else if (event.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED ||
+                       event.type == SDL_EVENT_RENDER_TARGETS_RESET || event.type == SDL_EVENT_RENDER_DEVICE_RESET) {
+                // Wrong size, or its contents are gone: draw it again on the next frame
+                SDL_DestroyTexture(background);
+                background = NULL;
             }
         }
 
-        Uint64 current_time = SDL_GetTicks();
-        float delta_time = (current_time - last_time) / 1000.0f;
-        last_time = current_time;
+        Uint64 frame_ns = SDL_GetTicksNS();
+        record_frame_time(&frame_stats, (frame_ns - last_frame_ns) / 1e6);
+        last_frame_ns = frame_ns;
+        if (!sim_thread) advance_simulation(&sim_clock);
 
-        // Load vehicles from file every 0.5 seconds
-        if (current_time - last_load_time > 500) {
-            load_vehicles();
-            last_load_time = current_time;
-        }
+        // Drawn between the last two steps, by how far real time has got past the latest
+        const Snapshot *snapshot = latest_snapshot();
+        float alpha = frame_ns > snapshot->step_ns ? (float)(frame_ns - snapshot->step_ns) / step_ns : 0;
+        if (alpha > 1) alpha = 1;
 
-        // Update traffic lights every 2 seconds
-        if (current_time - last_light_update > 2000) {
-            update_traffic_lights();
-            last_light_update = current_time;
-        }
+        Uint64 render_start_ns = SDL_GetTicksNS();
+        Uint64 start = profile_begin();
+        background_calls = draw_background(renderer);
+        profile_end(PHASE_DRAW_BACKGROUND, start);
+        start = profile_begin();
+        draw_traffic_lights(renderer, &snapshot->light);
+        profile_end(PHASE_DRAW_LIGHTS, start);
+        start = profile_begin();
+        vehicle_calls = draw_vehicles(renderer, snapshot, alpha);
+        profile_end(PHASE_DRAW_VEHICLES, start);
+        start = profile_begin();
+        draw_info(renderer, &snapshot->light);
+        profile_end(PHASE_DRAW_INFO, start);
+        if (show_profile) draw_profile_overlay(renderer);
+        record_frame_time(&render_stats, (SDL_GetTicksNS() - render_start_ns) / 1e6);
 
-        update_vehicles(delta_time);
+        start = profile_begin();
+        SDL_RenderPresent(renderer);
+        profile_end(PHASE_PRESENT, start);
+        frame_pacer_wait(&pacer);
+    }
 
-        // Clear screen
-        SDL_SetRenderDrawColor(renderer, 34, 139, 34, 255); // Green background
-        SDL_RenderClear(renderer);
+    if (sim_thread) {
+        SDL_SetAtomicInt(&sim_running, 0);
+        SDL_WaitThread(sim_thread, NULL);
+    }
+    if (ingest_thread) {
+        SDL_SetAtomicInt(&ingest_running, 0);
+        SDL_SignalSemaphore(ingest_wakeup);
+        SDL_WaitThread(ingest_thread, NULL);
+        close_source_watch(&watch);
+    }
+    SDL_DestroySemaphore(ingest_wakeup);
+    SDL_DestroyMutex(spawn_lock);
 
-        draw_roads(renderer);
-        draw_traffic_lights(renderer);
-        draw_vehicles(renderer);
-        draw_info(renderer);
+    print_frame_stats(&frame_stats);
+    if (render_stats.frames > 0) {
+        printf("Render phase: mean %.3f ms, max %.3f ms of CPU time per frame; background in %d draw call%s (%s), "
+               "vehicles in %d\n",
+               render_stats.mean_ms, render_stats.max_ms, background_calls, background_calls == 1 ? "" : "s",
+               background ? "cached" : "drawn every frame", vehicle_calls);
+    }
+    print_profile_report();
+    print_trip_stats(&trip_stats);
+    if (sim_clock.dropped_steps > 0) {
+        printf("Simulation fell behind: skipped %ld steps (%.2f s)\n", sim_clock.dropped_steps,
+               (double)(sim_clock.dropped_steps * step_ns) / SDL_NS_PER_SECOND);
+    }
+    print_latency_report();
+    print_backlog_report();
+    vehicle_ring_close(vehicle_ring);
+    index_free(&vehicle_index);
+    free_lanes();
+    pool_destroy(&vehicle_pool);
 
-        SDL_RenderPresent(renderer);
-        SDL_Delay(16); // ~60 FPS
+    int corrupt_records = 0, malformed_lines = 0;
+    for (int producer = 0; producer < MAX_PRODUCERS; producer++) {
+        vehicle_log_unmap(&segment_readers[producer].map);
+        corrupt_records += segment_readers[producer].corrupt_records;
+        malformed_lines += segment_readers[producer].malformed_lines;
+    }
+    if (corrupt_records > 0) {
+        printf("Skipped %d corrupt records in the binary log\n", corrupt_records);
+    }
+    if (malformed_lines > 0) {
+        printf("Skipped %d malformed lines in the text log\n", malformed_lines);
     }
 
+    for (int color = 0; color < 2; color++) {
+        free(vehicle_batches[color].rects);
+        for (int i = 0; i < 3; i++) free(snapshots[i].vehicles[color]);
+    }
+    SDL_DestroyTexture(background);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -1,31 +1,106 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <windows.h>
+#include "vehicle_log.h"
+#include "vehicle_ring.h"
 
-int main() {
-    srand(time(NULL));
+#define PRODUCER_ID 1 // Unique per generator so their vehicle IDs never collide
+
+int main(int argc, char *argv[]) {
+    bool use_shm = false;
+    bool use_text = false; // Human-readable .data segments instead of .bin
+    long stress_count = 0; // Push this many records as fast as possible, then report
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--shm") == 0) {
+            use_shm = true;
+        } else if (strcmp(argv[i], "--text") == 0) {
+            use_text = true;
+        } else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc) {
+            stress_count = atol(argv[++i]);
+        }
+    }
+
+    srand(time(NULL) + PRODUCER_ID);
     int vehicle_id = 1;
+    long created = 0;
 
-    printf("Generator started. Creating vehicles...\n");
+    // Carry on from the segment and vehicle ID this generator stopped at
+    long segment = 1, segment_records = 0;
+    if (!use_shm) {
+        int last_id;
+        segment = vehicle_log_resume_segment(PRODUCER_ID, use_text, &segment_records, &last_id);
+        vehicle_id = last_id + 1;
+    }
+    char path[64];
 
-    while (1) {
-        FILE *fp = fopen("vehicle.data", "a");
-        if (!fp) {
-            printf("Error: Cannot open vehicle.data\n");
+    VehicleRing *ring = NULL;
+    if (use_shm) {
+        ring = vehicle_ring_open();
+        if (!ring) {
+            printf("Error: Cannot open shared memory ring\n");
             return 1;
         }
+    }
+
+    vehicle_log_segment_path(path, sizeof(path), PRODUCER_ID, segment, use_text);
+    printf("Generator %d started (%s). Creating vehicles...\n", PRODUCER_ID, use_shm ? "shared memory" : path);
+    uint64_t start_ns = vehicle_clock_ns();
 
+    while (stress_count == 0 || created < stress_count) {
         int road = rand() % 4;
         int lane = rand() % 3;
 
-        fprintf(fp, "%d %d %d\n", road, lane, vehicle_id);
-        fclose(fp);
+        if (!use_shm) {
+            if (segment_records == VEHICLE_LOG_SEGMENT_RECORDS) {
+                // Segment is full; the simulator can retire it once it reads this far
+                segment++;
+                segment_records = 0;
+            }
+            vehicle_log_segment_path(path, sizeof(path), PRODUCER_ID, segment, use_text);
+        }
+
+        if (use_shm) {
+            VehicleRecord record = {road, lane, vehicle_id, PRODUCER_ID, vehicle_clock_ns()};
+            while (!vehicle_ring_push(ring, &record)) {
+                Sleep(1); // Simulator is behind; wait for it to drain
+            }
+        } else if (use_text) {
+            FILE *fp = fopen(path, "a");
+            if (!fp) {
+                printf("Error: Cannot open %s\n", path);
+                return 1;
+            }
+
+            VehicleLogEntry entry = {road, lane, vehicle_id, PRODUCER_ID, vehicle_log_now_us()};
+            vehicle_log_write_text(fp, &entry);
+            fclose(fp);
+            segment_records++;
+        } else {
+            VehicleLogEntry entry = {road, lane, vehicle_id, PRODUCER_ID, vehicle_log_now_us()};
+            if (!vehicle_log_append_binary(path, &entry)) {
+                printf("Error: Cannot write %s\n", path);
+                return 1;
+            }
+            segment_records++;
+        }
 
-        printf("Created: Vehicle %d on Road %d, Lane %d\n", vehicle_id, road, lane);
+        if (stress_count == 0) {
+            printf("Created: Vehicle %d on Road %d, Lane %d\n", vehicle_id, road, lane);
+        }
         vehicle_id++;
+        created++;
 
-        Sleep(500); // 0.5 seconds
+        if (stress_count == 0) {
+            Sleep(500); // 0.5 seconds
+        }
     }
+
+    double seconds = (vehicle_clock_ns() - start_ns) / 1e9;
+    printf("Stress: %ld records in %.3f s (%.0f records/sec)\n", stress_count, seconds, stress_count / seconds);
+
+    vehicle_ring_close(ring);
     return 0;
-}
\ No newline at end of file
+}
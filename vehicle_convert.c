@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vehicle_log.h"
+#include "vehicle_ring.h"
+
+// Converts between the text and binary vehicle logs, compares how fast each
+// format can be ingested, and cross-checks the SIMD text parser.
+
+void write_binary_entry(const VehicleLogEntry *entry, void *context) {
+    VehicleLogRecord record;
+    vehicle_log_encode(entry, &record);
+    fwrite(&record, sizeof(record), 1, context);
+}
+
+int text_to_binary(const char *in_path, const char *out_path) {
+    FILE *in = fopen(in_path, "rb");
+    FILE *out = fopen(out_path, "wb");
+    if (!in || !out) {
+        printf("Cannot open %s or %s\n", in_path, out_path);
+        if (in) fclose(in);
+        if (out) fclose(out);
+        return 1;
+    }
+
+    VehicleLogHeader header;
+    vehicle_log_init_header(&header);
+    fwrite(&header, sizeof(header), 1, out);
+
+    int skipped = 0;
+    long count = vehicle_log_read_text_file(in, write_binary_entry, out, &skipped);
+
+    fclose(in);
+    fclose(out);
+    if (count < 0) {
+        printf("Out of memory reading %s\n", in_path);
+        return 1;
+    }
+    printf("Converted %ld records (%d malformed lines skipped)\n", count, skipped);
+    return 0;
+}
+
+int binary_to_text(const char *in_path, const char *out_path) {
+    VehicleLogMap map;
+    if (!vehicle_log_map(&map, in_path) || !vehicle_log_check_header(map.data, map.size)) {
+        printf("%s is not a version %d vehicle log\n", in_path, VEHICLE_LOG_VERSION);
+        vehicle_log_unmap(&map);
+        return 1;
+    }
+
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        printf("Cannot open %s\n", out_path);
+        vehicle_log_unmap(&map);
+        return 1;
+    }
+
+    long count = 0, corrupt = 0;
+    VehicleLogEntry entry;
+    for (size_t offset = sizeof(VehicleLogHeader); offset + sizeof(VehicleLogRecord) <= map.size;
+         offset += sizeof(VehicleLogRecord)) {
+        if (!vehicle_log_decode((const VehicleLogRecord *)(map.data + offset), &entry)) {
+            corrupt++;
+            continue;
+        }
+        vehicle_log_write_text(out, &entry);
+        count++;
+    }
+
+    fclose(out);
+    vehicle_log_unmap(&map);
+    printf("Converted %ld records (%ld corrupt records skipped)\n", count, corrupt);
+    return 0;
+}
+
+void sum_ids(const VehicleLogEntry *entry, void *context) {
+    *(long long *)context += entry->id;
+}
+
+// Parses both files the way the simulator does and reports the rate of each
+int benchmark(const char *text_path, const char *binary_path) {
+    VehicleLogEntry entry;
+    long long checksum = 0; // Keeps the parse loops from being optimized away
+
+    // Line-at-a-time sscanf, as the simulator used to read the text log
+    FILE *in = fopen(text_path, "rb");
+    if (!in) {
+        printf("Cannot open %s\n", text_path);
+        return 1;
+    }
+    char line[256];
+    long sscanf_count = 0;
+    uint64_t start = vehicle_clock_ns();
+    while (fgets(line, sizeof(line), in)) {
+        if (vehicle_log_parse_text(line, &entry)) {
+            checksum += entry.id;
+            sscanf_count++;
+        }
+    }
+    double sscanf_seconds = (vehicle_clock_ns() - start) / 1e9;
+    long text_bytes = ftell(in);
+
+    // Batch parser
+    rewind(in);
+    start = vehicle_clock_ns();
+    long batch_count = vehicle_log_read_text_file(in, sum_ids, &checksum, NULL);
+    double batch_seconds = (vehicle_clock_ns() - start) / 1e9;
+    fclose(in);
+    if (batch_count < 0) {
+        printf("Out of memory reading %s\n", text_path);
+        return 1;
+    }
+
+    VehicleLogMap map;
+    start = vehicle_clock_ns();
+    if (!vehicle_log_map(&map, binary_path) || !vehicle_log_check_header(map.data, map.size)) {
+        printf("%s is not a version %d vehicle log\n", binary_path, VEHICLE_LOG_VERSION);
+        return 1;
+    }
+    long binary_count = 0;
+    for (size_t offset = sizeof(VehicleLogHeader); offset + sizeof(VehicleLogRecord) <= map.size;
+         offset += sizeof(VehicleLogRecord)) {
+        if (vehicle_log_decode((const VehicleLogRecord *)(map.data + offset), &entry)) {
+            checksum += entry.id;
+            binary_count++;
+        }
+    }
+    double binary_seconds = (vehicle_clock_ns() - start) / 1e9;
+    size_t binary_bytes = map.size;
+    vehicle_log_unmap(&map);
+
+    printf("Text (sscanf):     %ld records, %.1f MB in %.3f s (%.0f records/sec, %.1f MB/s)\n",
+           sscanf_count, text_bytes / 1e6, sscanf_seconds, sscanf_count / sscanf_seconds,
+           text_bytes / 1e6 / sscanf_seconds);
+    printf("Text (batch, %s): %ld records, %.1f MB in %.3f s (%.0f records/sec, %.1f MB/s)\n",
+           vehicle_log_classifier_name(), batch_count, text_bytes / 1e6, batch_seconds,
+           batch_count / batch_seconds, text_bytes / 1e6 / batch_seconds);
+    printf("Binary:            %ld records, %.1f MB in %.3f s (%.0f records/sec, %.1f MB/s)\n",
+           binary_count, binary_bytes / 1e6, binary_seconds, binary_count / binary_seconds,
+           binary_bytes / 1e6 / binary_seconds);
+    printf("(checksum %lld)\n", checksum);
+    return 0;
+}
+
+// Writes a synthetic text log of `count` records for benchmarking
+int synthesize(long long count, const char *out_path) {
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        printf("Cannot open %s\n", out_path);
+        return 1;
+    }
+
+    static char buffer[1 << 20];
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+    uint64_t arrival_us = vehicle_log_now_us();
+    for (long long i = 0; i < count; i++) {
+        VehicleLogEntry entry = {rand() % 4, rand() % 3, (int)(i % INT32_MAX) + 1, 1 + rand() % 3, arrival_us};
+        vehicle_log_write_text(out, &entry);
+        arrival_us += 500000;
+    }
+    fclose(out);
+    printf("Wrote %lld records to %s\n", count, out_path);
+    return 0;
+}
+
+// Random printable noise built from the characters that matter to the parser
+void fuzz_fill(char *buf, size_t len) {
+    static const char alphabet[] = "0123456789  \n\n\t\r-x";
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+}
+
+bool same_entries(const VehicleLogEntry *a, const VehicleLogEntry *b, int count) {
+    for (int i = 0; i < count; i++) {
+        if (a[i].road != b[i].road || a[i].lane != b[i].lane || a[i].id != b[i].id ||
+            a[i].producer != b[i].producer || a[i].arrival_us != b[i].arrival_us) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether sscanf reads a line as a record without any doubt: 3 to 5 fields
+// of plain digits, none too large for the field it goes in
+bool strict_record(const char *line, VehicleLogEntry *entry) {
+    static const unsigned long long limits[5] = {INT32_MAX, INT32_MAX, INT32_MAX, UINT16_MAX, 9999999999999999999ull};
+    int fields = 0;
+    const char *at = line + strspn(line, " \t\r");
+    while (*at) {
+        size_t digits = strspn(at, "0123456789");
+        if (digits == 0 || digits > 19 || fields == 5) return false;
+        if (strtoull(at, NULL, 10) > limits[fields++]) return false;
+        at += digits;
+        size_t gap = strspn(at, " \t\r");
+        if (gap == 0 && *at) return false;
+        at += gap;
+    }
+    return fields >= 3 && vehicle_log_parse_text(line, entry);
+}
+
+// Feeds malformed and well-formed input to the batch parser with every SIMD
+// classifier this CPU has and with the scalar one, and checks they agree with
+// each other and with sscanf on every line, both ways
+int fuzz(long iterations) {
+    static char buf[4096];
+    VehicleLogEntry simd[64], scalar[64];
+    long lines_checked = 0;
+
+    VehicleLogClassifyFn classifiers[2];
+    const char *names[2];
+    int classifier_count = 0;
+#ifdef VEHICLE_LOG_X86_SIMD
+    if (__builtin_cpu_supports("sse2")) {
+        names[classifier_count] = "SSE2";
+        classifiers[classifier_count++] = vehicle_log_classify_sse2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        names[classifier_count] = "AVX2";
+        classifiers[classifier_count++] = vehicle_log_classify_avx2;
+    }
+#endif
+    if (classifier_count == 0) {
+        names[classifier_count] = "scalar";
+        classifiers[classifier_count++] = vehicle_log_classify_scalar;
+    }
+
+    for (long it = 0; it < iterations; it++) {
+        size_t len = (size_t)(rand() % (int)sizeof(buf));
+        if (rand() % 2) {
+            fuzz_fill(buf, len);
+        } else {
+            // Mostly valid lines with occasional corruption
+            size_t pos = 0;
+            while (pos + 64 < len) {
+                pos += (size_t)snprintf(buf + pos, len - pos, "%d %d %d %d %d\n", rand() % 5, rand() % 4,
+                                        rand(), rand() % 4, rand());
+            }
+            len = pos;
+            if (len > 0 && rand() % 4 == 0) buf[rand() % len] = "x \n9"[rand() % 4];
+        }
+
+        int max_entries = 1 + rand() % 64;
+        int scalar_count, scalar_bad = 0;
+        vehicle_log_forced_classifier = vehicle_log_classify_scalar;
+        size_t scalar_used = vehicle_log_parse_text_batch(buf, len, scalar, max_entries, &scalar_count, &scalar_bad);
+
+        int simd_count = 0, simd_bad = 0;
+        size_t simd_used = 0;
+        for (int c = 0; c < classifier_count; c++) {
+            simd_bad = 0;
+            vehicle_log_forced_classifier = classifiers[c];
+            simd_used = vehicle_log_parse_text_batch(buf, len, simd, max_entries, &simd_count, &simd_bad);
+
+            if (simd_used != scalar_used || simd_count != scalar_count || simd_bad != scalar_bad ||
+                !same_entries(simd, scalar, simd_count)) {
+                printf("Mismatch between %s and scalar on iteration %ld\n", names[c], it);
+                return 1;
+            }
+        }
+        if (simd_used > len || (simd_used > 0 && buf[simd_used - 1] != '\n')) {
+            printf("Batch stopped mid-line on iteration %ld\n", it);
+            return 1;
+        }
+
+        // Every accepted record must also be what sscanf reads from its line,
+        // and every line sscanf strictly accepts must have been accepted
+        char line[4097];
+        int entry = 0;
+        for (size_t start = 0, end; start < simd_used; start = end + 1) {
+            end = start;
+            while (buf[end] != '\n') end++;
+            memcpy(line, buf + start, end - start);
+            line[end - start] = '\0';
+
+            VehicleLogEntry reference;
+            if (entry < simd_count && vehicle_log_parse_text(line, &reference) &&
+                strspn(line, "0123456789 \t\r") == end - start && same_entries(&reference, &simd[entry], 1)) {
+                entry++;
+            } else if (strict_record(line, &reference)) {
+                printf("Batch parser rejected a valid line on iteration %ld: \"%s\"\n", it, line);
+                return 1;
+            }
+            lines_checked++;
+        }
+        if (entry != simd_count) {
+            printf("Batch parser disagrees with sscanf on iteration %ld\n", it);
+            return 1;
+        }
+    }
+    vehicle_log_forced_classifier = NULL;
+
+    printf("Fuzz: %ld iterations, %ld lines, all classifiers agree with scalar and sscanf (", iterations,
+           lines_checked);
+    for (int c = 0; c < classifier_count; c++) {
+        printf("%s%s", c ? ", " : "", names[c]);
+    }
+    printf(")\n");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[1], "to-binary") == 0) {
+        return text_to_binary(argv[2], argv[3]);
+    }
+    if (argc == 4 && strcmp(argv[1], "to-text") == 0) {
+        return binary_to_text(argv[2], argv[3]);
+    }
+    if (argc == 4 && strcmp(argv[1], "bench") == 0) {
+        return benchmark(argv[2], argv[3]);
+    }
+    if (argc == 4 && strcmp(argv[1], "synth") == 0) {
+        return synthesize(atoll(argv[2]), argv[3]);
+    }
+    if (argc == 3 && strcmp(argv[1], "fuzz") == 0) {
+        return fuzz(atol(argv[2]));
+    }
+
+    printf("Usage:\n");
+    printf("  vehicle_convert to-binary <vehicle.data> <vehicle.bin>\n");
+    printf("  vehicle_convert to-text <vehicle.bin> <vehicle.data>\n");
+    printf("  vehicle_convert bench <vehicle.data> <vehicle.bin>\n");
+    printf("  vehicle_convert synth <count> <vehicle.data>\n");
+    printf("  vehicle_convert fuzz <iterations>\n");
+    return 1;
+}
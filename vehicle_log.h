@@ -0,0 +1,613 @@
+#ifndef VEHICLE_LOG_H
+#define VEHICLE_LOG_H
+
+// On-disk vehicle log formats shared by the generators, the simulator, the
+// receivers and vehicle_convert.
+//
+// Binary log (.bin): a VehicleLogHeader followed by fixed-width
+// VehicleLogRecords, little-endian, so record N lives at a known offset and
+// the file can be mapped and read in place.
+//
+// Text log (.data): one "road lane id [producer [arrival_us]]" line per
+// vehicle. Kept for debugging; the optional fields let older logs still load.
+//
+// Each generator writes its own log as numbered segments of
+// VEHICLE_LOG_SEGMENT_RECORDS records (vehicle-PP-SSSSSS.bin), starting the
+// next segment once one is full. The simulator records the last segment it
+// has read completely in vehicle.manifest and then deletes or archives it,
+// so the log never holds more than the unread tail.
+// vehicle_log_parse_text_batch() is the fast path for replaying big text logs:
+// it classifies newlines and whitespace 64 bytes at a time with SSE2/AVX2
+// (scalar elsewhere) and parses the digits between them without sscanf.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define VEHICLE_LOG_MANIFEST_PATH "vehicle.manifest"
+#define VEHICLE_LOG_SEGMENT_RECORDS 10000
+#define MAX_PRODUCERS 16
+#define VEHICLE_LOG_MAGIC "VLOG"
+#define VEHICLE_LOG_VERSION 1
+#define VEHICLE_LOG_TEXT_BUFFER 65536 // Longest text line read as a record, plus one
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VEHICLE_LOG_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    char magic[4];        // VEHICLE_LOG_MAGIC
+    uint32_t version;     // VEHICLE_LOG_VERSION
+    uint32_t record_size; // sizeof(VehicleLogRecord) when the file was written
+    uint32_t reserved;
+} VehicleLogHeader;
+
+typedef struct {
+    uint8_t road;
+    uint8_t lane;
+    uint16_t producer;
+    uint32_t id;
+    uint64_t arrival_us; // Wall-clock microseconds since the Unix epoch
+    uint32_t checksum;   // FNV-1a over the bytes before this field
+    uint32_t reserved;
+} VehicleLogRecord;
+
+_Static_assert(sizeof(VehicleLogHeader) == 16, "VehicleLogHeader must stay 16 bytes");
+_Static_assert(sizeof(VehicleLogRecord) == 24, "VehicleLogRecord must stay 24 bytes");
+
+// Decoded form of a record from either format
+typedef struct {
+    int road;
+    int lane;
+    int id;
+    int producer;
+    uint64_t arrival_us; // 0 if the log didn't record it
+} VehicleLogEntry;
+
+static inline uint64_t vehicle_log_now_us(void) {
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t ticks = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (ticks - 116444736000000000ull) / 10; // 100 ns ticks since 1601
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+static inline uint32_t vehicle_log_checksum(const VehicleLogRecord *record) {
+    const unsigned char *bytes = (const unsigned char *)record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(VehicleLogRecord, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static inline void vehicle_log_init_header(VehicleLogHeader *header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, VEHICLE_LOG_MAGIC, 4);
+    header->version = VEHICLE_LOG_VERSION;
+    header->record_size = sizeof(VehicleLogRecord);
+}
+
+static inline bool vehicle_log_check_header(const void *data, size_t size) {
+    if (size < sizeof(VehicleLogHeader)) return false;
+
+    VehicleLogHeader header;
+    memcpy(&header, data, sizeof(header));
+    return memcmp(header.magic, VEHICLE_LOG_MAGIC, 4) == 0 &&
+           header.version == VEHICLE_LOG_VERSION &&
+           header.record_size == sizeof(VehicleLogRecord);
+}
+
+static inline void vehicle_log_encode(const VehicleLogEntry *entry, VehicleLogRecord *record) {
+    memset(record, 0, sizeof(*record));
+    record->road = (uint8_t)entry->road;
+    record->lane = (uint8_t)entry->lane;
+    record->producer = (uint16_t)entry->producer;
+    record->id = (uint32_t)entry->id;
+    record->arrival_us = entry->arrival_us;
+    record->checksum = vehicle_log_checksum(record);
+}
+
+// Returns false if the record is corrupt
+static inline bool vehicle_log_decode(const VehicleLogRecord *record, VehicleLogEntry *entry) {
+    if (record->checksum != vehicle_log_checksum(record)) return false;
+    if (record->road > 3 || record->lane > 2) return false;
+
+    entry->road = record->road;
+    entry->lane = record->lane;
+    entry->producer = record->producer;
+    entry->id = (int)record->id;
+    entry->arrival_us = record->arrival_us;
+    return true;
+}
+
+// Parses one text line (without its newline) with sscanf. Returns false if
+// malformed. Simple reference for the batch parser below.
+static inline bool vehicle_log_parse_text(const char *line, VehicleLogEntry *entry) {
+    unsigned long long arrival_us = 0;
+    entry->producer = 0; // Lines without a producer field come from older generators
+    int fields = sscanf(line, "%d %d %d %d %llu", &entry->road, &entry->lane, &entry->id,
+                        &entry->producer, &arrival_us);
+    entry->arrival_us = arrival_us;
+    return fields >= 3 && entry->road >= 0 && entry->road <= 3 && entry->lane >= 0 && entry->lane <= 2;
+}
+
+// Sets bit i of *newlines for every '\n' in block[0..63], and bit i of
+// *spaces for every ' ', '\t' or '\r'
+typedef void (*VehicleLogClassifyFn)(const char *block, uint64_t *newlines, uint64_t *spaces);
+
+static inline void vehicle_log_classify_scalar(const char *block, uint64_t *newlines, uint64_t *spaces) {
+    uint64_t nl = 0, sp = 0;
+    for (int i = 0; i < 64; i++) {
+        char c = block[i];
+        nl |= (uint64_t)(c == '\n') << i;
+        sp |= (uint64_t)(c == ' ' || c == '\t' || c == '\r') << i;
+    }
+    *newlines = nl;
+    *spaces = sp;
+}
+
+#ifdef VEHICLE_LOG_X86_SIMD
+__attribute__((target("sse2")))
+static void vehicle_log_classify_sse2(const char *block, uint64_t *newlines, uint64_t *spaces) {
+    uint64_t nl = 0, sp = 0;
+    for (int i = 0; i < 64; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i is_nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+        __m128i is_sp = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+        nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_nl) << i;
+        sp |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_sp) << i;
+    }
+    *newlines = nl;
+    *spaces = sp;
+}
+
+__attribute__((target("avx2")))
+static void vehicle_log_classify_avx2(const char *block, uint64_t *newlines, uint64_t *spaces) {
+    uint64_t nl = 0, sp = 0;
+    for (int i = 0; i < 64; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+        __m256i is_nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+        __m256i is_sp = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+        nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_nl) << i;
+        sp |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_sp) << i;
+    }
+    *newlines = nl;
+    *spaces = sp;
+}
+#endif
+
+// Overrides the runtime choice when set, for cross-checking the SIMD paths
+static VehicleLogClassifyFn vehicle_log_forced_classifier = NULL;
+
+static inline VehicleLogClassifyFn vehicle_log_classifier(void) {
+    if (vehicle_log_forced_classifier) return vehicle_log_forced_classifier;
+#ifdef VEHICLE_LOG_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) return vehicle_log_classify_avx2;
+    if (__builtin_cpu_supports("sse2")) return vehicle_log_classify_sse2;
+#endif
+    return vehicle_log_classify_scalar;
+}
+
+static inline const char *vehicle_log_classifier_name(void) {
+    VehicleLogClassifyFn classify = vehicle_log_classifier();
+#ifdef VEHICLE_LOG_X86_SIMD
+    if (classify == vehicle_log_classify_avx2) return "AVX2";
+    if (classify == vehicle_log_classify_sse2) return "SSE2";
+#endif
+    (void)classify;
+    return "scalar";
+}
+
+// Parses an unsigned decimal token. Returns false if it has a non-digit or
+// doesn't fit in 64 bits.
+static inline bool vehicle_log_parse_u64(const char *p, size_t n, uint64_t *value) {
+    if (n == 0 || n > 20) return false;
+
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned digit = (unsigned char)p[i] - '0';
+        if (digit > 9) return false;
+        if (v > (UINT64_MAX - digit) / 10) return false;
+        v = v * 10 + digit;
+    }
+    *value = v;
+    return true;
+}
+
+// Turns the fields of one line into an entry. Returns false if malformed.
+static inline bool vehicle_log_finish_line(const uint64_t *fields, int field_count, VehicleLogEntry *entry) {
+    if (field_count < 3 || field_count > 5) return false;
+    if (fields[0] > 3 || fields[1] > 2 || fields[2] > INT32_MAX) return false;
+    if (field_count >= 4 && fields[3] > UINT16_MAX) return false;
+
+    entry->road = (int)fields[0];
+    entry->lane = (int)fields[1];
+    entry->id = (int)fields[2];
+    entry->producer = field_count >= 4 ? (int)fields[3] : 0;
+    entry->arrival_us = field_count >= 5 ? fields[4] : 0;
+    return true;
+}
+
+// Parses complete lines from buf[0..len) into entries[0..max_entries).
+// Stops after max_entries entries or at the last newline, whichever comes
+// first, and returns how many bytes that covers; a trailing partial line is
+// never consumed. *count receives the number of entries, and *malformed (if
+// not NULL) is incremented for every non-empty line that isn't a record.
+static inline size_t vehicle_log_parse_text_batch(const char *buf, size_t len, VehicleLogEntry *entries,
+                                                  int max_entries, int *count, int *malformed) {
+    VehicleLogClassifyFn classify = vehicle_log_classifier();
+    uint64_t fields[5];
+    int field_count = 0;
+    bool line_ok = true;
+    size_t token_start = 0; // Start of the token after the last delimiter
+    size_t consumed = 0;    // Just past the last newline handled
+    *count = 0;
+    if (max_entries <= 0) return 0;
+
+    for (size_t base = 0; base < len; base += 64) {
+        uint64_t newlines, spaces;
+        if (len - base >= 64) {
+            classify(buf + base, &newlines, &spaces);
+        } else {
+            // Last partial block: classify a padded copy and drop the padding bits
+            char block[64] = {0};
+            memcpy(block, buf + base, len - base);
+            classify(block, &newlines, &spaces);
+            uint64_t valid = ((uint64_t)1 << (len - base)) - 1;
+            newlines &= valid;
+            spaces &= valid;
+        }
+
+        uint64_t delimiters = newlines | spaces;
+        while (delimiters) {
+            int bit = __builtin_ctzll(delimiters);
+            delimiters &= delimiters - 1;
+            size_t at = base + (size_t)bit;
+
+            if (at > token_start) {
+                // The bytes since the previous delimiter form one field
+                if (field_count < 5 && vehicle_log_parse_u64(buf + token_start, at - token_start, &fields[field_count])) {
+                    field_count++;
+                } else {
+                    line_ok = false;
+                }
+            }
+            token_start = at + 1;
+
+            if ((newlines >> bit) & 1) {
+                if (field_count > 0 || !line_ok) {
+                    if (line_ok && vehicle_log_finish_line(fields, field_count, &entries[*count])) {
+                        (*count)++;
+                    } else if (malformed) {
+                        (*malformed)++;
+                    }
+                }
+                field_count = 0;
+                line_ok = true;
+                consumed = at + 1;
+                if (*count == max_entries) return consumed;
+            }
+        }
+    }
+    return consumed;
+}
+
+static inline void vehicle_log_write_text(FILE *fp, const VehicleLogEntry *entry) {
+    fprintf(fp, "%d %d %d %d %llu\n", entry->road, entry->lane, entry->id, entry->producer,
+            (unsigned long long)entry->arrival_us);
+}
+
+// Streams every record of a text log through visit(). Returns the number of
+// records, or -1 if out of memory; *malformed (if not NULL) counts lines that
+// weren't records.
+static inline long vehicle_log_read_text_file(FILE *fp, void (*visit)(const VehicleLogEntry *, void *),
+                                              void *context, int *malformed) {
+    char *buffer = malloc(VEHICLE_LOG_TEXT_BUFFER);
+    if (!buffer) return -1;
+    VehicleLogEntry batch[256];
+    size_t used = 0;
+    long records = 0;
+    bool eof = false;
+    bool discarding = false; // Inside an over-long line, skipping to its end
+
+    while (!eof) {
+        // One byte stays free to terminate a last line that has no newline
+        size_t n = fread(buffer + used, 1, VEHICLE_LOG_TEXT_BUFFER - 1 - used, fp);
+        used += n;
+        if (n == 0) {
+            eof = true;
+            if (used > 0) buffer[used++] = '\n';
+        }
+
+        if (discarding) {
+            char *newline = memchr(buffer, '\n', used);
+            if (!newline) {
+                used = 0;
+                continue;
+            }
+            used -= newline + 1 - buffer;
+            memmove(buffer, newline + 1, used);
+            discarding = false;
+        }
+
+        size_t consumed = 0, parsed;
+        int count;
+        while ((parsed = vehicle_log_parse_text_batch(buffer + consumed, used - consumed, batch, 256,
+                                                      &count, malformed)) > 0) {
+            for (int i = 0; i < count; i++) {
+                visit(&batch[i], context);
+            }
+            records += count;
+            consumed += parsed;
+        }
+
+        if (consumed == 0 && used == VEHICLE_LOG_TEXT_BUFFER - 1) {
+            // A line this long can't be a record; the rest of it goes too
+            if (malformed) (*malformed)++;
+            used = 0;
+            discarding = true;
+            continue;
+        }
+        used -= consumed;
+        memmove(buffer, buffer + consumed, used);
+    }
+    free(buffer);
+    return records;
+}
+
+// Cuts an open log back to size bytes
+static inline bool vehicle_log_truncate(FILE *fp, long size) {
+    if (fflush(fp) != 0) return false;
+#ifdef _WIN32
+    return _chsize_s(_fileno(fp), size) == 0;
+#else
+    return ftruncate(fileno(fp), (off_t)size) == 0;
+#endif
+}
+
+// Appends one record to the binary log, writing the header first if the
+// file is new. A partial header or trailing record left by a writer that
+// crashed mid-write is cut off first, so the new record lands on a record
+// boundary. Returns false on I/O failure.
+static inline bool vehicle_log_append_binary(const char *path, const VehicleLogEntry *entry) {
+    FILE *fp = fopen(path, "r+b");
+    if (!fp) fp = fopen(path, "w+b");
+    if (!fp) return false;
+
+    bool ok = fseek(fp, 0, SEEK_END) == 0;
+    long size = ftell(fp);
+    long whole = size;
+    if (size < (long)sizeof(VehicleLogHeader)) {
+        whole = 0;
+    } else {
+        whole -= (size - (long)sizeof(VehicleLogHeader)) % (long)sizeof(VehicleLogRecord);
+    }
+    if (ok && whole != size) {
+        ok = vehicle_log_truncate(fp, whole) && fseek(fp, whole, SEEK_SET) == 0;
+    }
+
+    if (ok && whole == 0) {
+        VehicleLogHeader header;
+        vehicle_log_init_header(&header);
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    }
+
+    VehicleLogRecord record;
+    vehicle_log_encode(entry, &record);
+    ok = ok && fwrite(&record, sizeof(record), 1, fp) == 1;
+    return fclose(fp) == 0 && ok;
+}
+
+// Read-only mapping of a whole log file
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} VehicleLogMap;
+
+// Returns the current size of the file at path, or -1 if it doesn't exist
+static inline long long vehicle_log_file_size(const char *path) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes)) return -1;
+    return ((long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    return (long long)st.st_size;
+#endif
+}
+
+// Maps the file as it is now. Returns false if it is missing or empty.
+static inline bool vehicle_log_map(VehicleLogMap *map, const char *path) {
+    memset(map, 0, sizeof(*map));
+#ifdef _WIN32
+    // Share everything so generators can keep appending and rotating
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const unsigned char *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!data) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    map->file = file;
+    map->mapping = mapping;
+    map->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    const unsigned char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    map->size = (size_t)st.st_size;
+#endif
+    map->data = data;
+    return true;
+}
+
+static inline void vehicle_log_unmap(VehicleLogMap *map) {
+    if (!map->data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(map->data);
+    CloseHandle(map->mapping);
+    CloseHandle(map->file);
+#else
+    munmap((void *)map->data, map->size);
+#endif
+    memset(map, 0, sizeof(*map));
+}
+
+// Name of one segment of a producer's log. Segments are numbered from 1.
+static inline void vehicle_log_segment_path(char *path, size_t size, int producer, long segment, bool text) {
+    snprintf(path, size, "vehicle-%02d-%06ld.%s", producer, segment, text ? "data" : "bin");
+}
+
+// Whether a file name (no directory) is a log segment, of either format
+static inline bool vehicle_log_is_segment_name(const char *name) {
+    int producer, end = 0;
+    long segment;
+    char format[5];
+    if (sscanf(name, "vehicle-%2d-%6ld.%4[a-z]%n", &producer, &segment, format, &end) != 3 || name[end] != '\0') {
+        return false;
+    }
+    return strcmp(format, "data") == 0 || strcmp(format, "bin") == 0;
+}
+
+// What the simulator has finished with, per producer
+typedef struct {
+    long consumed[MAX_PRODUCERS]; // Last segment read completely, 0 if none
+    int last_id[MAX_PRODUCERS];   // Highest vehicle ID in those segments
+} VehicleLogManifest;
+
+// Loads the manifest, or leaves it all zero if there isn't one yet
+static inline void vehicle_log_read_manifest(VehicleLogManifest *manifest) {
+    memset(manifest, 0, sizeof(*manifest));
+    FILE *fp = fopen(VEHICLE_LOG_MANIFEST_PATH, "r");
+    if (!fp) return;
+
+    int producer, last_id;
+    long consumed;
+    while (fscanf(fp, "%d %ld %d", &producer, &consumed, &last_id) == 3) {
+        if (producer < 0 || producer >= MAX_PRODUCERS || consumed < 0) continue;
+        manifest->consumed[producer] = consumed;
+        manifest->last_id[producer] = last_id;
+    }
+    fclose(fp);
+}
+
+// Replaces the manifest in one step, so readers never see half of it.
+// Returns false on I/O failure.
+static inline bool vehicle_log_write_manifest(const VehicleLogManifest *manifest) {
+    FILE *fp = fopen(VEHICLE_LOG_MANIFEST_PATH ".tmp", "w");
+    if (!fp) return false;
+
+    for (int producer = 0; producer < MAX_PRODUCERS; producer++) {
+        if (manifest->consumed[producer] == 0) continue;
+        fprintf(fp, "%d %ld %d\n", producer, manifest->consumed[producer], manifest->last_id[producer]);
+    }
+    if (fclose(fp) != 0) return false;
+#ifdef _WIN32
+    return MoveFileExA(VEHICLE_LOG_MANIFEST_PATH ".tmp", VEHICLE_LOG_MANIFEST_PATH, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(VEHICLE_LOG_MANIFEST_PATH ".tmp", VEHICLE_LOG_MANIFEST_PATH) == 0;
+#endif
+}
+
+static inline void vehicle_log_track_last_id(const VehicleLogEntry *entry, void *context) {
+    int *last_id = context;
+    if (entry->id > *last_id) *last_id = entry->id;
+}
+
+// Finds where a restarted generator should carry on: the newest segment of
+// its log still on disk (or the first one after what the simulator has
+// consumed), how many records that segment already holds, and the highest
+// vehicle ID written so far, so IDs keep increasing across restarts.
+static inline long vehicle_log_resume_segment(int producer, bool text, long *records, int *last_id) {
+    VehicleLogManifest manifest;
+    vehicle_log_read_manifest(&manifest);
+
+    char path[64];
+    long segment = manifest.consumed[producer] + 1;
+    for (;;) {
+        vehicle_log_segment_path(path, sizeof(path), producer, segment + 1, text);
+        if (vehicle_log_file_size(path) < 0) break;
+        segment++;
+    }
+
+    *records = 0;
+    *last_id = manifest.last_id[producer];
+    vehicle_log_segment_path(path, sizeof(path), producer, segment, text);
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return segment;
+
+    if (text) {
+        *records = vehicle_log_read_text_file(fp, vehicle_log_track_last_id, last_id, NULL);
+        if (*records < 0) {
+            // Out of memory: how full this segment is isn't known, so start the next one
+            *records = 0;
+            segment++;
+        }
+    } else {
+        VehicleLogRecord record;
+        VehicleLogEntry entry;
+        fseek(fp, sizeof(VehicleLogHeader), SEEK_SET);
+        while (fread(&record, sizeof(record), 1, fp) == 1) {
+            if (vehicle_log_decode(&record, &entry)) vehicle_log_track_last_id(&entry, last_id);
+            (*records)++;
+        }
+    }
+    fclose(fp);
+    return segment;
+}
+
+#endif
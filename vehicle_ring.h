@@ -0,0 +1,272 @@
+#ifndef VEHICLE_RING_H
+#define VEHICLE_RING_H
+
+// Shared-memory transport between the traffic generators and the simulator.
+// A multi-producer/single-consumer lock-free ring of fixed-size vehicle
+// records lives in a named shared memory segment, so pushing and draining
+// records needs no system calls once the segment is mapped. Each slot has a
+// sequence number that tells producers and the consumer whose turn it is.
+// A consumer that runs out of records can sleep on a named event/semaphore,
+// which producers only signal while the consumer says it is waiting.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "vehicle_log.h" // MAX_PRODUCERS
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define VEHICLE_RING_NAME "traffic_vehicle_ring"
+#define VEHICLE_RING_CAPACITY 4096 // Must be a power of two
+#define VEHICLE_RING_MAGIC 0x56524E32u // "VRN2"
+#define VEHICLE_RING_INITIALIZING 1u
+#define VEHICLE_RING_REINITIALIZING 2u
+#define VEHICLE_RING_INIT_TIMEOUT_MS 1000 // Longest wait for another process to number the slots
+
+typedef struct {
+    int32_t road;
+    int32_t lane;
+    int32_t id;       // Sequence number, counted separately by each producer
+    int32_t producer; // 1..MAX_PRODUCERS-1; 0 is used for legacy records
+    uint64_t sent_ns; // vehicle_clock_ns() when the generator pushed it
+} VehicleRecord;
+
+typedef struct {
+    _Atomic uint32_t sequence; // == position when free, position + 1 when filled
+    uint32_t pad;
+    VehicleRecord record;
+} VehicleRingSlot;
+
+typedef struct {
+    _Atomic uint32_t magic;
+    uint32_t capacity;
+    char pad0[56];
+    _Atomic uint32_t head; // Next position to claim, shared by all producers
+    char pad1[60];
+    _Atomic uint32_t tail; // Next position to read, owned by the consumer
+    _Atomic uint32_t consumer_waiting; // Set while the consumer sleeps in vehicle_ring_wait()
+    char pad2[56];
+    VehicleRingSlot slots[VEHICLE_RING_CAPACITY];
+} VehicleRing;
+
+// Monotonic clock shared by all processes on the machine, in nanoseconds
+static inline uint64_t vehicle_clock_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ull +
+           (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ull / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#ifdef _WIN32
+static HANDLE vehicle_ring_mapping = NULL;
+static HANDLE vehicle_ring_ready = NULL;
+#else
+static sem_t *vehicle_ring_ready = SEM_FAILED;
+#endif
+
+static inline void vehicle_ring_close(VehicleRing *ring) {
+    if (!ring) return;
+#ifdef _WIN32
+    UnmapViewOfFile(ring);
+    CloseHandle(vehicle_ring_mapping);
+    vehicle_ring_mapping = NULL;
+    if (vehicle_ring_ready) CloseHandle(vehicle_ring_ready);
+    vehicle_ring_ready = NULL;
+#else
+    munmap(ring, sizeof(VehicleRing));
+    if (vehicle_ring_ready != SEM_FAILED) sem_close(vehicle_ring_ready);
+    vehicle_ring_ready = SEM_FAILED;
+#endif
+}
+
+// Empties the ring and numbers its slots, then publishes it to everyone
+// waiting in vehicle_ring_open()
+static inline void vehicle_ring_init(VehicleRing *ring) {
+    ring->capacity = VEHICLE_RING_CAPACITY;
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->consumer_waiting, 0, memory_order_relaxed);
+    for (uint32_t i = 0; i < VEHICLE_RING_CAPACITY; i++) {
+        atomic_store_explicit(&ring->slots[i].sequence, i, memory_order_relaxed);
+    }
+    atomic_store_explicit(&ring->magic, VEHICLE_RING_MAGIC, memory_order_release);
+}
+
+// Waits up to VEHICLE_RING_INIT_TIMEOUT_MS for the ring to be initialized.
+// Returns the magic it last saw.
+static inline uint32_t vehicle_ring_wait_ready(VehicleRing *ring) {
+    uint64_t deadline = vehicle_clock_ns() + VEHICLE_RING_INIT_TIMEOUT_MS * 1000000ull;
+    uint32_t magic;
+    while ((magic = atomic_load_explicit(&ring->magic, memory_order_acquire)) != VEHICLE_RING_MAGIC &&
+           (magic == VEHICLE_RING_INITIALIZING || magic == VEHICLE_RING_REINITIALIZING) &&
+           vehicle_clock_ns() < deadline) {
+#ifdef _WIN32
+        Sleep(1);
+#else
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+#endif
+    }
+    return magic;
+}
+
+// Maps the ring, creating it if neither side has done so yet.
+// Returns NULL on failure, including a ring that no one finished setting up.
+static inline VehicleRing *vehicle_ring_open(void) {
+    VehicleRing *ring;
+#ifdef _WIN32
+    vehicle_ring_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                              0, sizeof(VehicleRing), "Local\\" VEHICLE_RING_NAME);
+    if (!vehicle_ring_mapping) return NULL;
+
+    ring = MapViewOfFile(vehicle_ring_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(VehicleRing));
+    if (!ring) {
+        CloseHandle(vehicle_ring_mapping);
+        vehicle_ring_mapping = NULL;
+        return NULL;
+    }
+    vehicle_ring_ready = CreateEventA(NULL, FALSE, FALSE, "Local\\" VEHICLE_RING_NAME "_ready");
+#else
+    int fd = shm_open("/" VEHICLE_RING_NAME, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) return NULL;
+
+    if (ftruncate(fd, sizeof(VehicleRing)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    ring = mmap(NULL, sizeof(VehicleRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) return NULL;
+    vehicle_ring_ready = sem_open("/" VEHICLE_RING_NAME "_ready", O_CREAT, 0600, 0);
+#endif
+
+    // A fresh segment is zero-filled. Whoever maps it first numbers the
+    // slots; everyone else waits for that, but not forever: if the process
+    // doing it crashed part way, one opener takes over after a timeout.
+    uint32_t expected = 0;
+    if (atomic_compare_exchange_strong(&ring->magic, &expected, VEHICLE_RING_INITIALIZING)) {
+        vehicle_ring_init(ring);
+    }
+    if (vehicle_ring_wait_ready(ring) == VEHICLE_RING_MAGIC) return ring;
+
+    expected = VEHICLE_RING_INITIALIZING;
+    if (atomic_compare_exchange_strong(&ring->magic, &expected, VEHICLE_RING_REINITIALIZING)) {
+        vehicle_ring_init(ring);
+    }
+    if (vehicle_ring_wait_ready(ring) == VEHICLE_RING_MAGIC) return ring;
+
+    vehicle_ring_close(ring); // Stuck again, or another layout altogether
+    return NULL;
+}
+
+// Producer side, safe to call from any number of processes.
+// Returns false if the ring is full.
+static inline bool vehicle_ring_push(VehicleRing *ring, const VehicleRecord *record) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    for (;;) {
+        VehicleRingSlot *slot = &ring->slots[head & (VEHICLE_RING_CAPACITY - 1)];
+        uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int32_t diff = (int32_t)(sequence - head);
+
+        if (diff == 0) {
+            // Slot is free for this position; claim it before anyone else does
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &head, head + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->record = *record;
+                atomic_store_explicit(&slot->sequence, head + 1, memory_order_release);
+
+                // Wake the consumer only if it went to sleep on an empty ring
+                atomic_thread_fence(memory_order_seq_cst);
+                if (atomic_exchange(&ring->consumer_waiting, 0)) {
+#ifdef _WIN32
+                    if (vehicle_ring_ready) SetEvent(vehicle_ring_ready);
+#else
+                    if (vehicle_ring_ready != SEM_FAILED) sem_post(vehicle_ring_ready);
+#endif
+                }
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // Consumer hasn't released this slot from the previous lap
+        } else {
+            head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+// Consumer side. Returns the oldest unread record without consuming it,
+// or NULL if the ring is empty or the next record is still being written.
+static inline const VehicleRecord *vehicle_ring_peek(VehicleRing *ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    VehicleRingSlot *slot = &ring->slots[tail & (VEHICLE_RING_CAPACITY - 1)];
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != tail + 1) return NULL;
+
+    return &slot->record;
+}
+
+// Consumer side. Releases the record returned by vehicle_ring_peek().
+static inline void vehicle_ring_advance(VehicleRing *ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    VehicleRingSlot *slot = &ring->slots[tail & (VEHICLE_RING_CAPACITY - 1)];
+    atomic_store_explicit(&slot->sequence, tail + VEHICLE_RING_CAPACITY, memory_order_release);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_relaxed);
+}
+
+// Consumer side. Sleeps until a producer pushes a record or timeout_ms passes.
+// Returns immediately if a record is already available.
+static inline void vehicle_ring_wait(VehicleRing *ring, int timeout_ms) {
+    atomic_store(&ring->consumer_waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (vehicle_ring_peek(ring)) {
+        atomic_store(&ring->consumer_waiting, 0);
+        return;
+    }
+
+#ifdef _WIN32
+    if (vehicle_ring_ready) {
+        WaitForSingleObject(vehicle_ring_ready, (DWORD)timeout_ms);
+    } else {
+        Sleep((DWORD)timeout_ms);
+    }
+#else
+    if (vehicle_ring_ready != SEM_FAILED) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (sem_timedwait(vehicle_ring_ready, &deadline) != 0 && errno == EINTR) {
+        }
+    } else {
+        usleep((useconds_t)timeout_ms * 1000);
+    }
+#endif
+    atomic_store(&ring->consumer_waiting, 0);
+}
+
+#endif